@@ -1,7 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-only
 /*
  * gcalc/gcalc.c
- * 
+ *
  * Simple calculator for Goldspace.
  *
  * Copyright (C) 2024 Goldside543
@@ -9,39 +9,3415 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_REGS 1024      // variables + constants + temporaries per expression
+#define MAX_NAME 32
+#define MAX_DEPTH 256      // parser recursion limit
+#define MAX_HEIGHT 10000   // expression tree height; compiling recurses this deep
+#define BATCH_BLOCK (16 << 20) // input handed to the workers per round
+#define MAX_THREADS 64
+
+// Operations. The first two only exist in the parse tree; the rest are
+// bytecode instructions.
+enum {
+    OP_NUM,
+    OP_VAR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_NEG,
+    OP_SQRT,
+    OP_ABS,
+    OP_FLOOR,
+    OP_CEIL,
+    OP_ROUND,
+    OP_EXP,
+    OP_LN,
+    OP_LOG10,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_ATAN,
+    OP_ATAN2,
+    OP_HYPOT,
+    OP_MIN,
+    OP_MAX,
+};
+
+static const struct {
+    const char *name;
+    int args;
+    int op;
+} functions[] = {
+    { "sqrt", 1, OP_SQRT }, { "abs", 1, OP_ABS }, { "floor", 1, OP_FLOOR },
+    { "ceil", 1, OP_CEIL }, { "round", 1, OP_ROUND }, { "exp", 1, OP_EXP },
+    { "ln", 1, OP_LN }, { "log", 1, OP_LN }, { "log10", 1, OP_LOG10 },
+    { "sin", 1, OP_SIN }, { "cos", 1, OP_COS }, { "tan", 1, OP_TAN },
+    { "asin", 1, OP_ASIN }, { "acos", 1, OP_ACOS }, { "atan", 1, OP_ATAN },
+    { "atan2", 2, OP_ATAN2 }, { "hypot", 2, OP_HYPOT }, { "pow", 2, OP_POW },
+    { "min", 2, OP_MIN }, { "max", 2, OP_MAX },
+};
 
-void calculate(double a, double b, char op) {
+// One instruction: regs[dst] = op(regs[a], regs[b])
+typedef struct {
+    uint8_t op;
+    uint16_t dst, a, b;
+} Instr;
+
+// A compiled expression. Registers are laid out as variables, then
+// constants, then temporaries, so the variables double as the bindings.
+typedef struct {
+    Instr *code;
+    int len;
+    double *consts;
+    int nconsts;
+    char (*vars)[MAX_NAME];
+    int nvars;
+    int nregs;
+    int result;                // register holding the value once run
+} Program;
+
+// Function to apply one operation. Shared by constant folding and the
+// evaluator so both always agree.
+static inline double apply(int op, double a, double b) {
     switch (op) {
-        case '+':
-            printf("Result: %.2f\n", a + b);
-            break;
-        case '-':
-            printf("Result: %.2f\n", a - b);
-            break;
-        case '*':
-            printf("Result: %.2f\n", a * b);
-            break;
-        case '/':
-            if (b != 0)
-                printf("Result: %.2f\n", a / b);
-            else
-                printf("Error: Division by zero\n");
-            break;
-        default:
-            printf("Error: Unsupported operator\n");
+        case OP_ADD: return a + b;
+        case OP_SUB: return a - b;
+        case OP_MUL: return a * b;
+        case OP_DIV: return a / b;
+        case OP_MOD: return fmod(a, b);
+        case OP_POW: return pow(a, b);
+        case OP_NEG: return -a;
+        case OP_SQRT: return sqrt(a);
+        case OP_ABS: return fabs(a);
+        case OP_FLOOR: return floor(a);
+        case OP_CEIL: return ceil(a);
+        case OP_ROUND: return round(a);
+        case OP_EXP: return exp(a);
+        case OP_LN: return log(a);
+        case OP_LOG10: return log10(a);
+        case OP_SIN: return sin(a);
+        case OP_COS: return cos(a);
+        case OP_TAN: return tan(a);
+        case OP_ASIN: return asin(a);
+        case OP_ACOS: return acos(a);
+        case OP_ATAN: return atan(a);
+        case OP_ATAN2: return atan2(a, b);
+        case OP_HYPOT: return hypot(a, b);
+        case OP_MIN: return fmin(a, b);
+        case OP_MAX: return fmax(a, b);
+        default: return NAN;
+    }
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Function to parse a decimal number. When the digits fit in 53 bits and
+// the power of ten is at most 22, both are exact doubles and one multiply
+// or divide rounds correctly; anything else goes to strtod, which is exact
+// but much slower.
+double parse_number(const char *text, const char **end) {
+    const char *pos = text;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+
+    for (; *pos >= '0' && *pos <= '9'; pos++, digits++)
+        mantissa = mantissa * 10 + (*pos - '0');
+    if (*pos == '.')
+        for (pos++; *pos >= '0' && *pos <= '9'; pos++, digits++, exponent--)
+            mantissa = mantissa * 10 + (*pos - '0');
+
+    if (*pos == 'e' || *pos == 'E') {
+        const char *mark = pos++;
+        int negative = 0, value = 0;
+
+        if (*pos == '+' || *pos == '-')
+            negative = *pos++ == '-';
+        if (*pos < '0' || *pos > '9') {
+            pos = mark; // "2e" is the number 2 followed by e
+        } else {
+            for (; *pos >= '0' && *pos <= '9'; pos++)
+                if (value < 10000)
+                    value = value * 10 + (*pos - '0');
+            exponent += negative ? -value : value;
+        }
+    }
+    *end = pos;
+
+    if (digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+        return exponent < 0 ? mantissa / powers_of_ten[-exponent] : mantissa * powers_of_ten[exponent];
+
+    char *strtod_end;
+    return strtod(text, &strtod_end);
+}
+
+// Function to write the shortest decimal that reads back as value. Returns
+// its length. Most results are short decimals: those are found by scaling
+// by 10^k until the digits are an integer that divides back to value
+// exactly. Only 17-digit and very large or small values need printf.
+int format_number(double value, char *out) {
+    double magnitude = fabs(value);
+    char digits[24];
+    int len = 0, n = 0;
+
+    if (isnan(value))
+        return sprintf(out, "nan");
+    if (signbit(value))
+        out[len++] = '-';
+    if (isinf(value))
+        return len + sprintf(out + len, "inf");
+
+    if (magnitude < 0x1p53 && (magnitude >= 1e-4 || magnitude == 0)) {
+        for (int k = 0; k <= 22; k++) {
+            double scaled = round(magnitude * powers_of_ten[k]);
+
+            if (scaled >= 0x1p53)
+                break;
+            if (scaled / powers_of_ten[k] != magnitude)
+                continue;
+
+            uint64_t integer = (uint64_t)scaled;
+
+            do {
+                digits[n++] = '0' + integer % 10;
+                integer /= 10;
+            } while (integer || n <= k); // at least one digit before the point
+            while (n > k)
+                out[len++] = digits[--n];
+            if (k)
+                out[len++] = '.';
+            while (n > 0)
+                out[len++] = digits[--n];
+            out[len] = '\0';
+            return len;
+        }
+    }
+
+    // Nothing up to 15 digits fits in the loop above for in-range values,
+    // so only try the longer precisions there
+    for (int precision = magnitude >= 1e-4 && magnitude < 0x1p53 ? 16 : 1; ; precision++) {
+        int written = sprintf(out + len, "%.*g", precision, magnitude);
+
+        if (precision == 17 || strtod(out + len, NULL) == magnitude) {
+            // %g goes to an exponent past its precision, which below 10^16
+            // can be longer than the 16-digit integer
+            if (magnitude >= 0x1p53 && magnitude < 1e16 && written > 16)
+                written = sprintf(out + len, "%.0f", magnitude);
+            return len + written;
+        }
+    }
+}
+
+// Parse tree node. Leaves hold a number or a variable index.
+typedef struct {
+    int op;
+    int a, b;                  // children, or the variable index for OP_VAR
+    int height;                // 1 for leaves
+    double value;
+} Node;
+
+typedef struct {
+    const char *text;
+    const char *pos;
+    const char *error;
+    const char *error_at;
+    int depth;
+    Node *nodes;
+    int nnodes;
+    int cap;
+    Program *prog;
+    int constant_only;         // variables are an error
+} Parser;
+
+static int parse_sum(Parser *p);
+
+static void skip_space(Parser *p) {
+    while (isspace((unsigned char)*p->pos))
+        p->pos++;
+}
+
+static int fail(Parser *p, const char *error) {
+    if (!p->error) {
+        p->error = error;
+        p->error_at = p->pos;
+    }
+    return -1;
+}
+
+static int add_node(Parser *p, int op, int a, int b, double value) {
+    if (p->nnodes == p->cap) {
+        int cap = p->cap ? p->cap * 2 : 64;
+        Node *nodes = realloc(p->nodes, cap * sizeof(*nodes));
+
+        if (!nodes)
+            return fail(p, "Out of memory");
+        p->nodes = nodes;
+        p->cap = cap;
+    }
+    p->nodes[p->nnodes] = (Node){ op, a, b, 1, value };
+    return p->nnodes++;
+}
+
+// Function to add an operation node, folding it to a number right away
+// when every operand already is one. Long chains like a+a+...+a nest
+// without recursing in the parser, so their height is limited here.
+static int add_op(Parser *p, int op, int a, int b) {
+    int height, node;
+
+    if (a < 0 || b < 0)
+        return -1;
+    // Division by zero is left in the program, so running it can tell
+    if (p->nodes[a].op == OP_NUM && p->nodes[b].op == OP_NUM &&
+        (p->constant_only || !((op == OP_DIV || op == OP_MOD) && p->nodes[b].value == 0)))
+        return add_node(p, OP_NUM, 0, 0, apply(op, p->nodes[a].value, p->nodes[b].value));
+    height = 1 + (p->nodes[a].height > p->nodes[b].height ? p->nodes[a].height : p->nodes[b].height);
+    if (height > MAX_HEIGHT)
+        return fail(p, "Expression too complex");
+    node = add_node(p, op, a, b, 0);
+    if (node >= 0)
+        p->nodes[node].height = height;
+    return node;
+}
+
+static int find_var(const Program *prog, const char *name) {
+    for (int i = 0; i < prog->nvars; i++)
+        if (!strcmp(prog->vars[i], name))
+            return i;
+    return -1;
+}
+
+static int parse_name(Parser *p) {
+    const char *start = p->pos;
+    char name[MAX_NAME];
+    int len;
+
+    while (isalnum((unsigned char)*p->pos) || *p->pos == '_')
+        p->pos++;
+    len = p->pos - start;
+    if (len >= MAX_NAME) {
+        p->pos = start;
+        return fail(p, "Name too long");
+    }
+    memcpy(name, start, len);
+    name[len] = '\0';
+    skip_space(p);
+
+    if (*p->pos == '(') {
+        int args[2] = { -1, -1 };
+        int f, n = 0;
+
+        for (f = 0; f < (int)(sizeof(functions) / sizeof(functions[0])); f++)
+            if (!strcmp(functions[f].name, name))
+                break;
+        if (f == (int)(sizeof(functions) / sizeof(functions[0]))) {
+            p->pos = start;
+            return fail(p, "Unknown function");
+        }
+
+        p->pos++;
+        do {
+            if (n == functions[f].args)
+                return fail(p, "Too many arguments");
+            skip_space(p);
+            args[n++] = parse_sum(p);
+            if (args[n - 1] < 0)
+                return -1;
+        } while (*p->pos == ',' && p->pos++);
+        if (*p->pos != ')')
+            return fail(p, "Expected ')'");
+        p->pos++;
+        skip_space(p);
+        if (n != functions[f].args)
+            return fail(p, "Too few arguments");
+        return add_op(p, functions[f].op, args[0], n == 2 ? args[1] : args[0]);
+    }
+
+    if (!strcmp(name, "pi"))
+        return add_node(p, OP_NUM, 0, 0, M_PI);
+    if (!strcmp(name, "e"))
+        return add_node(p, OP_NUM, 0, 0, M_E);
+
+    if (p->constant_only) {
+        p->pos = start;
+        return fail(p, "Unknown variable");
+    }
+
+    Program *prog = p->prog;
+    int var = find_var(prog, name);
+
+    if (var < 0) {
+        char (*vars)[MAX_NAME] = realloc(prog->vars, (prog->nvars + 1) * sizeof(*vars));
+
+        if (!vars)
+            return fail(p, "Out of memory");
+        prog->vars = vars;
+        var = prog->nvars++;
+        strcpy(prog->vars[var], name);
+    }
+    return add_node(p, OP_VAR, var, 0, 0);
+}
+
+// primary: number | name | name(args) | ( sum )
+static int parse_primary(Parser *p) {
+    int node;
+
+    skip_space(p);
+    if (isdigit((unsigned char)*p->pos) || (*p->pos == '.' && isdigit((unsigned char)p->pos[1]))) {
+        const char *end;
+        double value = parse_number(p->pos, &end);
+
+        p->pos = end;
+        node = add_node(p, OP_NUM, 0, 0, value);
+    } else if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+        return parse_name(p);
+    } else if (*p->pos == '(') {
+        p->pos++;
+        node = parse_sum(p);
+        if (node < 0)
+            return -1;
+        if (*p->pos != ')')
+            return fail(p, "Expected ')'");
+        p->pos++;
+    } else {
+        return fail(p, *p->pos ? "Unexpected character" : "Unexpected end of expression");
+    }
+    skip_space(p);
+    return node;
+}
+
+// unary: -unary | +unary | power
+// power: primary [^ unary]    (right associative, so -2^2 is -4 and 2^-1 works)
+static int parse_unary(Parser *p) {
+    int node;
+
+    if (++p->depth > MAX_DEPTH)
+        return fail(p, "Expression too deeply nested");
+    skip_space(p);
+    if (*p->pos == '-' || *p->pos == '+') {
+        int negate = *p->pos++ == '-';
+
+        node = parse_unary(p);
+        if (negate)
+            node = add_op(p, OP_NEG, node, node);
+    } else {
+        node = parse_primary(p);
+        if (node >= 0 && *p->pos == '^') {
+            p->pos++;
+            node = add_op(p, OP_POW, node, parse_unary(p));
+        }
+    }
+    p->depth--;
+    return node;
+}
+
+// product: unary {(* | / | %) unary}
+static int parse_product(Parser *p) {
+    int node = parse_unary(p);
+
+    while (node >= 0 && (*p->pos == '*' || *p->pos == '/' || *p->pos == '%')) {
+        int op = *p->pos == '*' ? OP_MUL : *p->pos == '/' ? OP_DIV : OP_MOD;
+
+        p->pos++;
+        node = add_op(p, op, node, parse_unary(p));
+    }
+    return node;
+}
+
+// sum: product {(+ | -) product}
+static int parse_sum(Parser *p) {
+    int node = parse_product(p);
+
+    while (node >= 0 && (*p->pos == '+' || *p->pos == '-')) {
+        int op = *p->pos == '+' ? OP_ADD : OP_SUB;
+
+        p->pos++;
+        node = add_op(p, op, node, parse_product(p));
+    }
+    return node;
+}
+
+// Function to give every distinct number left after folding a register
+static int collect_consts(Parser *p, int node) {
+    Node *n = &p->nodes[node];
+    Program *prog = p->prog;
+
+    if (n->op == OP_VAR)
+        return 0;
+    if (n->op != OP_NUM)
+        return collect_consts(p, n->a) || collect_consts(p, n->b);
+
+    for (int i = 0; i < prog->nconsts; i++)
+        if (!memcmp(&prog->consts[i], &n->value, sizeof(double))) {
+            n->a = i;
+            return 0;
+        }
+    double *consts = realloc(prog->consts, (prog->nconsts + 1) * sizeof(*consts));
+
+    if (!consts)
+        return fail(p, "Out of memory");
+    prog->consts = consts;
+    prog->consts[prog->nconsts] = n->value;
+    n->a = prog->nconsts++;
+    return 0;
+}
+
+// Function to emit the code for node. Returns the register holding its
+// value. Temporaries are handed out like a stack starting at *next.
+static int emit(Parser *p, int node, int *next) {
+    Node *n = &p->nodes[node];
+    Program *prog = p->prog;
+    int base = *next, a, b;
+
+    if (n->op == OP_VAR)
+        return n->a;
+    if (n->op == OP_NUM)
+        return prog->nvars + n->a;
+
+    a = emit(p, n->a, next);
+    b = n->b == n->a ? a : emit(p, n->b, next);
+    if (a < 0 || b < 0)
+        return -1;
+
+    *next = base; // the operands are dead once read, so dst may reuse theirs
+    if (*next >= MAX_REGS)
+        return fail(p, "Expression too complex");
+    if (*next + 1 > prog->nregs)
+        prog->nregs = *next + 1;
+
+    Instr *code = realloc(prog->code, (prog->len + 1) * sizeof(*code));
+
+    if (!code)
+        return fail(p, "Out of memory");
+    prog->code = code;
+    prog->code[prog->len++] = (Instr){ n->op, *next, a, b };
+    return (*next)++;
+}
+
+void program_free(Program *prog) {
+    free(prog->code);
+    free(prog->consts);
+    free(prog->vars);
+    memset(prog, 0, sizeof(*prog));
+}
+
+// Function to compile text into prog. On failure returns -1 with the
+// message and the offset it refers to.
+int program_compile(Program *prog, const char *text, const char **error, int *error_at) {
+    Parser p = { .text = text, .pos = text, .prog = prog };
+    int root;
+
+    memset(prog, 0, sizeof(*prog));
+    root = parse_sum(&p);
+    if (root >= 0 && *p.pos)
+        root = fail(&p, "Unexpected character");
+    if (root >= 0 && prog->nvars >= MAX_REGS)
+        root = fail(&p, "Expression too complex");
+    if (root >= 0)
+        root = collect_consts(&p, root) ? -1 : root;
+    if (root >= 0) {
+        int next = prog->nvars + prog->nconsts;
+
+        prog->nregs = next;
+        prog->result = emit(&p, root, &next);
+        root = prog->result;
+    }
+    free(p.nodes);
+
+    if (root < 0) {
+        *error = p.error;
+        *error_at = p.error_at - text;
+        program_free(prog);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to return the register a variable is bound through, or -1 if
+// the expression doesn't use it
+int program_var(const Program *prog, const char *name) {
+    return find_var(prog, name);
+}
+
+// Function to set up a register file for prog: copies in the constants.
+// Variables are then bound by writing regs[program_var(...)], as often as
+// needed, between runs.
+void program_load(const Program *prog, double *regs) {
+    if (prog->nconsts)
+        memcpy(regs + prog->nvars, prog->consts, prog->nconsts * sizeof(double));
+}
+
+// Function to run prog on a register file set up by program_load
+double program_run(const Program *prog, double *regs) {
+    for (const Instr *in = prog->code, *end = in + prog->len; in < end; in++)
+        regs[in->dst] = apply(in->op, regs[in->a], regs[in->b]);
+    return regs[prog->result];
+}
+
+// Function to run prog like program_run, but stop with -1 at the first
+// division or remainder by zero
+int program_run_checked(const Program *prog, double *regs, double *result) {
+    for (const Instr *in = prog->code, *end = in + prog->len; in < end; in++) {
+        if ((in->op == OP_DIV || in->op == OP_MOD) && regs[in->b] == 0)
+            return -1;
+        regs[in->dst] = apply(in->op, regs[in->a], regs[in->b]);
+    }
+    *result = regs[prog->result];
+    return 0;
+}
+
+// JIT: compiles a Program to x86-64 SSE2 code. The variables arrive as
+// the function's double arguments, which the SysV ABI passes in xmm0-7,
+// and stay there. Temporaries get the xmm registers after them, xmm15 is
+// scratch, and constants are read from a pool placed after the code. Only
+// operations with an exact single-instruction form are compiled; for
+// anything else, or when the system won't map the code executable,
+// jit_compile() fails with the reason and the caller keeps interpreting.
+#define JIT_ARGS 8
+#define JIT_SCRATCH 15
+
+typedef double (*JitFn)(double, double, double, double, double, double, double, double);
+
+typedef struct {
+    JitFn fn;
+    void *mem;
+    size_t size;
+} Jit;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+typedef struct {
+    uint8_t *code;
+    size_t len;
+    struct {
+        size_t at;             // disp32 position
+        size_t end;            // end of the instruction it belongs to
+        int slot;
+    } *fixups;                 // rip-relative operands, patched once the pool is placed
+    int nfixups;
+} JitBuffer;
+
+// Pool slots are 8 bytes; the masks take two each so xorpd/andpd can use
+// them as 16-byte aligned operands
+enum {
+    POOL_SIGN = 0,
+    POOL_ABS = 2,
+    POOL_CONSTS = 4,
+};
+
+// Operand: an xmm register, or a pool slot (memory) when slot >= 0
+typedef struct {
+    int xmm;
+    int slot;
+} JitOperand;
+
+static void jit_byte(JitBuffer *j, uint8_t b) {
+    j->code[j->len++] = b;
+}
+
+// Function to emit [prefix] [REX] 0F op... ModRM for "op reg, rm"
+static void jit_sse(JitBuffer *j, uint8_t prefix, const uint8_t *op, int oplen, int reg, JitOperand rm, int imm) {
+    uint8_t rex = 0x40 | (reg >= 8 ? 4 : 0) | (rm.slot < 0 && rm.xmm >= 8 ? 1 : 0);
+
+    if (prefix)
+        jit_byte(j, prefix);
+    if (rex != 0x40)
+        jit_byte(j, rex);
+    jit_byte(j, 0x0F);
+    for (int i = 0; i < oplen; i++)
+        jit_byte(j, op[i]);
+
+    if (rm.slot < 0) {
+        jit_byte(j, 0xC0 | (reg & 7) << 3 | (rm.xmm & 7));
+    } else {
+        jit_byte(j, (reg & 7) << 3 | 5); // [rip + disp32]
+        j->fixups[j->nfixups].at = j->len;
+        j->fixups[j->nfixups].slot = rm.slot;
+        j->len += 4;
+    }
+    if (imm >= 0)
+        jit_byte(j, imm);
+    if (rm.slot >= 0)
+        j->fixups[j->nfixups++].end = j->len;
+}
+
+static void jit_op(JitBuffer *j, uint8_t prefix, uint8_t op, int reg, JitOperand rm) {
+    jit_sse(j, prefix, &op, 1, reg, rm, -1);
+}
+
+// Function to get value into register reg (movsd from memory, movapd
+// between registers)
+static void jit_load(JitBuffer *j, int reg, JitOperand value) {
+    if (value.slot >= 0)
+        jit_op(j, 0xF2, 0x10, reg, value);
+    else if (value.xmm != reg)
+        jit_op(j, 0x66, 0x28, reg, value);
+}
+
+static JitOperand jit_operand(const Program *prog, int r) {
+    int first_temp = prog->nvars + prog->nconsts;
+
+    if (r < prog->nvars)
+        return (JitOperand){ r, -1 };
+    if (r < first_temp)
+        return (JitOperand){ -1, POOL_CONSTS + r - prog->nvars };
+    return (JitOperand){ prog->nvars + r - first_temp, -1 };
+}
+
+int jit_compile(const Program *prog, Jit *jit, const char **why) {
+    JitBuffer j;
+    int sse41 = __builtin_cpu_supports("sse4.1");
+
+    memset(jit, 0, sizeof(*jit));
+    if (prog->nvars > JIT_ARGS) {
+        *why = "more than 8 variables";
+        return -1;
+    }
+    if (prog->nregs - prog->nconsts > JIT_SCRATCH) {
+        *why = "too many live values for the xmm registers";
+        return -1;
+    }
+    for (int i = 0; i < prog->len; i++) {
+        int op = prog->code[i].op;
+
+        if (op == OP_ADD || op == OP_SUB || op == OP_MUL || op == OP_DIV ||
+            op == OP_NEG || op == OP_ABS || op == OP_SQRT ||
+            ((op == OP_FLOOR || op == OP_CEIL) && sse41))
+            continue;
+        *why = "uses an operation with no single-instruction form";
+        return -1;
+    }
+
+    // At most three instructions of up to 10 bytes per operation, with
+    // two memory operands between them, plus the result move and ret
+    size_t cap = (prog->len + 1) * 30 + 16 + (POOL_CONSTS + prog->nconsts) * 8;
+
+    jit->size = (cap + 4095) & ~(size_t)4095;
+    jit->mem = mmap(NULL, jit->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    j.fixups = malloc((2 * prog->len + 1) * sizeof(*j.fixups));
+    if (jit->mem == MAP_FAILED || !j.fixups) {
+        if (jit->mem != MAP_FAILED)
+            munmap(jit->mem, jit->size);
+        jit->mem = NULL;
+        free(j.fixups);
+        *why = "out of memory";
+        return -1;
+    }
+    j.code = jit->mem;
+    j.len = 0;
+    j.nfixups = 0;
+
+    for (int i = 0; i < prog->len; i++) {
+        const Instr *in = &prog->code[i];
+        JitOperand a = jit_operand(prog, in->a), b = jit_operand(prog, in->b);
+        int dst = jit_operand(prog, in->dst).xmm;
+        static const uint8_t arith[] = { [OP_ADD] = 0x58, [OP_SUB] = 0x5C, [OP_MUL] = 0x59, [OP_DIV] = 0x5E };
+
+        switch (in->op) {
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV: {
+                // dst = a op b; when dst is b, work in scratch so b survives
+                int work = b.slot < 0 && b.xmm == dst && !(a.slot < 0 && a.xmm == dst) ? JIT_SCRATCH : dst;
+
+                jit_load(&j, work, a);
+                jit_op(&j, 0xF2, arith[in->op], work, b);
+                jit_load(&j, dst, (JitOperand){ work, -1 });
+                break;
+            }
+            case OP_NEG:
+            case OP_ABS:
+                jit_load(&j, dst, a);
+                jit_op(&j, 0x66, in->op == OP_NEG ? 0x57 : 0x54, dst,
+                       (JitOperand){ -1, in->op == OP_NEG ? POOL_SIGN : POOL_ABS });
+                break;
+            case OP_SQRT:
+                jit_op(&j, 0xF2, 0x51, dst, a);
+                break;
+            case OP_FLOOR:
+            case OP_CEIL: {
+                static const uint8_t roundsd[] = { 0x3A, 0x0B };
+
+                // 8 suppresses the inexact exception; 1 rounds down, 2 up
+                jit_sse(&j, 0x66, roundsd, 2, dst, a, in->op == OP_FLOOR ? 9 : 10);
+                break;
+            }
+        }
+    }
+    jit_load(&j, 0, jit_operand(prog, prog->result));
+    jit_byte(&j, 0xC3); // ret
+
+    // The pool follows the code, 16-byte aligned for the masks
+    size_t pool = (j.len + 15) & ~(size_t)15;
+    uint64_t *slots = (uint64_t *)(j.code + pool);
+
+    slots[0] = slots[1] = 0x8000000000000000ULL;
+    slots[2] = slots[3] = 0x7FFFFFFFFFFFFFFFULL;
+    memcpy(slots + POOL_CONSTS, prog->consts, prog->nconsts * sizeof(double));
+    for (int i = 0; i < j.nfixups; i++) {
+        int32_t disp = (int32_t)(pool + 8 * j.fixups[i].slot - j.fixups[i].end);
+
+        memcpy(j.code + j.fixups[i].at, &disp, sizeof(disp));
+    }
+    free(j.fixups);
+
+    // Write, then execute: never both at once
+    if (mprotect(jit->mem, jit->size, PROT_READ | PROT_EXEC) < 0) {
+        munmap(jit->mem, jit->size);
+        jit->mem = NULL;
+        *why = "the system won't map code executable";
+        return -1;
+    }
+    jit->fn = (JitFn)jit->mem;
+    return 0;
+}
+#else
+int jit_compile(const Program *prog, Jit *jit, const char **why) {
+    (void)prog;
+    memset(jit, 0, sizeof(*jit));
+    *why = "only available on x86-64";
+    return -1;
+}
+#endif
+
+void jit_free(Jit *jit) {
+    if (jit->mem)
+        munmap(jit->mem, jit->size);
+    memset(jit, 0, sizeof(*jit));
+}
+
+// Function to run compiled code on the variables in regs
+static inline double jit_run(const Jit *jit, const double *regs) {
+    return jit->fn(regs[0], regs[1], regs[2], regs[3], regs[4], regs[5], regs[6], regs[7]);
+}
+
+// Function to evaluate text that uses no variables. It folds to a single
+// number while parsing, so no Program is needed. p keeps its node storage
+// between calls.
+int evaluate(Parser *p, const char *text, double *result, const char **error, int *error_at) {
+    int root;
+
+    p->text = p->pos = text;
+    p->error = NULL;
+    p->depth = 0;
+    p->nnodes = 0;
+    p->constant_only = 1;
+    root = parse_sum(p);
+    if (root >= 0 && *p->pos)
+        root = fail(p, "Unexpected character");
+    if (root < 0) {
+        *error = p->error;
+        *error_at = p->error_at - text;
+        return -1;
+    }
+    *result = p->nodes[root].value;
+    return 0;
+}
+
+static void print_error(const char *text, const char *error, int at) {
+    printf("Error: %s\n", error);
+    printf("  %s\n  %*s^\n", text, at, "");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to time re-running prog with every variable nudged each time,
+// through the interpreter and then through the JIT
+static void bench(const Program *prog, double *regs, long runs) {
+    double start_values[MAX_REGS];
+    double sums[2] = { 0, 0 };
+    const char *why;
+    Jit jit;
+
+    printf("%d instructions, %d variables, %d constants, %d registers\n",
+           prog->len, prog->nvars, prog->nconsts, prog->nregs);
+    memcpy(start_values, regs, prog->nvars * sizeof(double));
+    if (jit_compile(prog, &jit, &why) < 0)
+        printf("jit unavailable: %s\n", why);
+
+    for (int use_jit = 0; use_jit <= (jit.fn != NULL); use_jit++) {
+        double sum = 0, start = now_seconds(), elapsed;
+
+        for (long i = 0; i < runs; i++) {
+            for (int v = 0; v < prog->nvars; v++)
+                regs[v] = start_values[v] + i * 1e-6;
+            sum += use_jit ? jit_run(&jit, regs) : program_run(prog, regs);
+        }
+        elapsed = now_seconds() - start;
+        sums[use_jit] = sum;
+
+        printf("%-11s %ld evaluations in %.3f s: %.1f ns each, %.2f M/s (checksum %.17g)\n",
+               use_jit ? "jit" : "interpreter", runs, elapsed, elapsed * 1e9 / runs, runs / elapsed / 1e6, sum);
+    }
+    if (jit.fn && memcmp(&sums[0], &sums[1], sizeof(double)))
+        printf("Error: jit and interpreter disagree\n");
+    jit_free(&jit);
+}
+
+// Batch mode: one expression per input line, one result per output line.
+// Each block of input is cut at line boundaries into one slice per
+// worker. Every worker formats its results into its own buffer, and the
+// buffers are written out in slice order.
+typedef struct {
+    const char *start, *end;
+    char *out;
+    size_t out_len, out_cap;
+    char *line;
+    size_t line_cap;
+    Parser parser;
+    long lines;
+    int failed;                // out of memory
+} BatchWorker;
+
+typedef struct {
+    BatchWorker workers[MAX_THREADS];
+    int threads;
+    long lines;
+    long long bytes;
+    int failed;
+} Batch;
+
+static int grow(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap)
+        return 0;
+
+    size_t cap2 = *cap ? *cap : 4096;
+    while (cap2 < need)
+        cap2 *= 2;
+    char *buf2 = realloc(*buf, cap2);
+
+    if (!buf2)
+        return -1;
+    *buf = buf2;
+    *cap = cap2;
+    return 0;
+}
+
+static void *batch_worker(void *arg) {
+    BatchWorker *w = arg;
+
+    w->out_len = 0;
+    for (const char *pos = w->start; pos < w->end; w->lines++) {
+        const char *newline = memchr(pos, '\n', w->end - pos);
+        size_t len = (newline ? newline : w->end) - pos;
+        const char *error;
+        double result;
+        int error_at;
+
+        // The parser wants a terminated string, which a mapped file lacks
+        if (grow(&w->line, &w->line_cap, len + 1) < 0 ||
+            grow(&w->out, &w->out_cap, w->out_len + 128) < 0) {
+            w->failed = 1;
+            return NULL;
+        }
+        memcpy(w->line, pos, len);
+        pos = newline ? newline + 1 : w->end;
+        if (len && w->line[len - 1] == '\r')
+            len--;
+        w->line[len] = '\0';
+
+        char *out = w->out + w->out_len;
+
+        if (w->line[strspn(w->line, " \t")] == '\0')
+            ; // blank lines stay blank
+        else if (evaluate(&w->parser, w->line, &result, &error, &error_at) < 0)
+            out += sprintf(out, "Error: %s at column %d", error, error_at + 1);
+        else
+            out += format_number(result, out);
+        *out++ = '\n';
+        w->out_len = out - w->out;
+    }
+    return NULL;
+}
+
+// Function to evaluate len bytes of whole lines and write the results
+static void batch_block(Batch *batch, const char *buf, size_t len) {
+    pthread_t threads[MAX_THREADS];
+    char started[MAX_THREADS] = { 0 };
+    const char *pos = buf, *end = buf + len;
+    int n = 0;
+
+    // Small blocks aren't worth a thread each
+    for (; n < batch->threads && pos < end; n++) {
+        BatchWorker *w = &batch->workers[n];
+        size_t share = (end - pos) / (batch->threads - n);
+        const char *cut = share < 65536 ? end : pos + share;
+        const char *newline = cut < end ? memchr(cut, '\n', end - cut) : NULL;
+
+        w->start = pos;
+        w->end = pos = newline ? newline + 1 : end;
+    }
+
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&threads[i], NULL, batch_worker, &batch->workers[i]) == 0;
+        if (!started[i])
+            batch_worker(&batch->workers[i]);
+    }
+    if (n)
+        batch_worker(&batch->workers[0]);
+
+    for (int i = 0; i < n; i++) {
+        BatchWorker *w = &batch->workers[i];
+
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        batch->failed |= w->failed;
+        fwrite(w->out, 1, w->out_len, stdout);
+    }
+    batch->bytes += len;
+}
+
+// Function to evaluate every line of a mapped file
+static void batch_mapped(Batch *batch, const char *data, size_t size) {
+    size_t offset = 0;
+
+    while (offset < size && !batch->failed) {
+        size_t end = size - offset > BATCH_BLOCK ? offset + BATCH_BLOCK : size;
+        const char *newline = end < size ? memchr(data + end, '\n', size - end) : NULL;
+
+        end = newline ? (size_t)(newline - data) + 1 : size;
+        batch_block(batch, data + offset, end - offset);
+        offset = end;
+    }
+}
+
+// Function to evaluate every line read from fd, a block at a time
+static int batch_stream(Batch *batch, int fd) {
+    size_t cap = BATCH_BLOCK, have = 0;
+    char *buf = malloc(cap);
+    int eof = 0;
+
+    if (!buf)
+        return -1;
+    while (!eof && !batch->failed) {
+        ssize_t got = read(fd, buf + have, cap - have);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            free(buf);
+            return -1;
+        }
+        eof = got == 0;
+        have += got;
+        if (have < cap && !eof)
+            continue; // fill the block before handing it out
+
+        size_t whole = have;
+
+        while (!eof && whole > 0 && buf[whole - 1] != '\n')
+            whole--;
+
+        if (!whole && have == cap) {
+            // One line longer than the buffer
+            char *buf2 = realloc(buf, cap * 2);
+
+            if (!buf2) {
+                free(buf);
+                return -1;
+            }
+            buf = buf2;
+            cap *= 2;
+            continue;
+        }
+        batch_block(batch, buf, whole);
+        memmove(buf, buf + whole, have - whole);
+        have -= whole;
     }
+    free(buf);
+    return 0;
 }
 
-int main() {
-    double a, b;
-    char op;
+static int run_batch(const char *path, int threads) {
+    static Batch batch;
+    struct stat st;
+    double start = now_seconds(), elapsed;
+    int fd = 0, status;
+
+    batch.threads = threads;
+    if (path && strcmp(path, "-")) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+
+    void *data = MAP_FAILED;
 
-    printf("Enter calculation (e.g., 3.5 + 4.2): ");
-    if (scanf("%lf %c %lf", &a, &op, &b) == 3) {
-        calculate(a, b, op);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        batch_mapped(&batch, data, st.st_size);
+        munmap(data, st.st_size);
+        status = 0;
     } else {
-        printf("Invalid input\n");
+        status = batch_stream(&batch, fd); // pipes, and files mmap won't take
+    }
+    if (fd)
+        close(fd);
+    fflush(stdout);
+
+    if (status < 0 || batch.failed) {
+        fprintf(stderr, "Error: %s\n", status < 0 ? strerror(errno) : "Out of memory");
+        return 1;
+    }
+
+    for (int i = 0; i < threads; i++)
+        batch.lines += batch.workers[i].lines;
+    elapsed = now_seconds() - start;
+    fprintf(stderr, "%ld lines, %.1f MB in %.3f s: %.0f lines/s, %.1f MB/s (%d threads)\n",
+            batch.lines, batch.bytes / 1e6, elapsed, batch.lines / elapsed,
+            batch.bytes / 1e6 / elapsed, threads);
+    return 0;
+}
+
+// Columnar mode: evaluate one expression over every row of a numeric CSV.
+// The columns the expression uses are parsed into arrays up front. Then
+// each instruction runs over a chunk of rows at a time, so the dispatch
+// cost is paid once per chunk instead of once per row.
+#define COLUMN_CHUNK 512
+#define JIT_TRIAL_CHUNKS 16        // chunks timed both ways before choosing
+
+enum {
+    AGG_SUM = 1,
+    AGG_MIN = 2,
+    AGG_MAX = 4,
+    AGG_MEAN = 8,
+};
+
+typedef void (*ColumnOp)(int op, double *dst, const double *a, const double *b, int n);
+
+static void column_op_scalar(int op, double *dst, const double *a, const double *b, int n) {
+    // The common operators get loops of their own so the compiler can
+    // vectorize them with whatever the baseline target allows
+    switch (op) {
+        case OP_ADD: for (int i = 0; i < n; i++) dst[i] = a[i] + b[i]; break;
+        case OP_SUB: for (int i = 0; i < n; i++) dst[i] = a[i] - b[i]; break;
+        case OP_MUL: for (int i = 0; i < n; i++) dst[i] = a[i] * b[i]; break;
+        case OP_DIV: for (int i = 0; i < n; i++) dst[i] = a[i] / b[i]; break;
+        case OP_NEG: for (int i = 0; i < n; i++) dst[i] = -a[i]; break;
+        default: for (int i = 0; i < n; i++) dst[i] = apply(op, a[i], b[i]); break;
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define AVX2_LOOP(expr) \
+    for (; i + 4 <= n; i += 4) { \
+        __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i); \
+        (void)y; \
+        _mm256_storeu_pd(dst + i, expr); \
+    }
+
+__attribute__((target("avx2")))
+static void column_op_avx2(int op, double *dst, const double *a, const double *b, int n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    int i = 0;
+
+    switch (op) {
+        case OP_ADD: AVX2_LOOP(_mm256_add_pd(x, y)); break;
+        case OP_SUB: AVX2_LOOP(_mm256_sub_pd(x, y)); break;
+        case OP_MUL: AVX2_LOOP(_mm256_mul_pd(x, y)); break;
+        case OP_DIV: AVX2_LOOP(_mm256_div_pd(x, y)); break;
+        case OP_NEG: AVX2_LOOP(_mm256_xor_pd(x, sign)); break;
+        case OP_ABS: AVX2_LOOP(_mm256_andnot_pd(sign, x)); break;
+        case OP_SQRT: AVX2_LOOP(_mm256_sqrt_pd(x)); break;
+        case OP_FLOOR: AVX2_LOOP(_mm256_floor_pd(x)); break;
+        case OP_CEIL: AVX2_LOOP(_mm256_ceil_pd(x)); break;
+        default: break; // the rest have no exact vector form here
+    }
+    column_op_scalar(op, dst + i, a + i, b + i, n - i);
+}
+#endif
+
+static ColumnOp pick_column_op(const char **name) {
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return column_op_avx2;
+    }
+#endif
+    *name = "scalar";
+    return column_op_scalar;
+}
+
+// Function to read all of path (or stdin for "-"), NUL terminated
+static char *read_all(const char *path, size_t *size) {
+    int fd = strcmp(path, "-") ? open(path, O_RDONLY) : 0;
+    size_t cap = 1 << 20, len = 0;
+    char *buf = malloc(cap);
+
+    if (fd < 0 || !buf) {
+        free(buf);
+        return NULL;
+    }
+    for (;;) {
+        if (len + 1 == cap) {
+            char *buf2 = realloc(buf, cap * 2);
+
+            if (!buf2)
+                break;
+            buf = buf2;
+            cap *= 2;
+        }
+
+        ssize_t got = read(fd, buf + len, cap - len - 1);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0) {
+            if (fd)
+                close(fd);
+            if (got < 0)
+                break;
+            buf[len] = '\0';
+            *size = len;
+            return buf;
+        }
+        len += got;
+    }
+    free(buf);
+    return NULL;
+}
+
+// Function to parse the field at *pos as a number and move *pos to the
+// delimiter after it. Returns -1 if the field isn't just a number.
+static int csv_number(const char **pos, double *value) {
+    const char *p = *pos, *end;
+    int negative = 0;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    if (*p == '-' || *p == '+')
+        negative = *p++ == '-';
+    *value = parse_number(p, &end);
+    if (negative)
+        *value = -*value;
+    if (end == p || (*p == '.' && end == p + 1))
+        *value = NAN;
+    p = end;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    *pos = p;
+    while (**pos && **pos != ',' && **pos != '\n')
+        (*pos)++;
+    return isnan(*value) || (p != *pos && *p != '\r') ? -1 : 0;
+}
+
+// Function to find which column a variable names: colN, or a header field
+static int csv_column(const char *name, const char *header) {
+    if (!strncmp(name, "col", 3) && name[3] >= '1' && name[3] <= '9' &&
+        strspn(name + 3, "0123456789") == strlen(name + 3))
+        return atoi(name + 3) - 1;
+
+    for (int index = 0; header && *header && *header != '\n'; index++) {
+        const char *field = header, *end;
+
+        while (*header && *header != ',' && *header != '\n')
+            header++;
+        end = header;
+        if (*header == ',')
+            header++;
+        while (field < end && (*field == ' ' || *field == '"'))
+            field++;
+        while (end > field && (end[-1] == ' ' || end[-1] == '"' || end[-1] == '\r'))
+            end--;
+        if ((size_t)(end - field) == strlen(name) && !memcmp(field, name, end - field))
+            return index;
+    }
+    return -1;
+}
+
+static int run_columns(const char *path, const char *text, int aggregates) {
+    const char *error, *op_name;
+    int error_at, status = 1;
+    Program prog;
+    size_t size;
+    char *data = read_all(path, &size);
+    double start = now_seconds(), parsed, elapsed;
+    ColumnOp column_op = pick_column_op(&op_name);
+    Jit jit = { 0 };
+
+    if (!data) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (program_compile(&prog, text, &error, &error_at) < 0) {
+        print_error(text, error, error_at);
+        free(data);
+        return 1;
+    }
+
+    // The first line is a header if any of its fields isn't a number;
+    // empty fields are just missing values
+    const char *pos = data, *header = NULL;
+
+    while (*pos && *pos != '\n') {
+        const char *field = pos;
+        double value;
+
+        if (csv_number(&pos, &value) < 0 && field + strspn(field, " \t\r") < pos)
+            header = data;
+        if (*pos == ',')
+            pos++;
+    }
+    pos = header ? pos + (*pos == '\n') : data;
+
+    int column[MAX_REGS], owner[MAX_REGS], last_column = -1;
+    int *wanted = NULL;          // column -> first variable naming it, or -1
+    double *cols[MAX_REGS] = { NULL };
+    double *regs[MAX_REGS];
+    double *scratch = NULL;
+    long rows = 0, cap = 0;
+
+    for (int v = 0; v < prog.nvars; v++) {
+        column[v] = csv_column(prog.vars[v], header);
+        if (column[v] < 0) {
+            printf("Error: No column named %s\n", prog.vars[v]);
+            goto out;
+        }
+        if (column[v] > last_column)
+            last_column = column[v];
+    }
+    wanted = malloc((last_column + 2) * sizeof(*wanted));
+    if (!wanted)
+        goto oom;
+    for (int c = 0; c <= last_column; c++)
+        wanted[c] = -1;
+    for (int v = prog.nvars - 1; v >= 0; v--)
+        wanted[column[v]] = v;
+
+    // Names for the same column (col1 and its header name) share one array
+    for (int v = 0; v < prog.nvars; v++)
+        owner[v] = wanted[column[v]];
+
+    // Parse the wanted columns into arrays. Missing or bad fields are NaN.
+    while (*pos) {
+        if (*pos == '\n' || (*pos == '\r' && pos[1] == '\n')) {
+            pos += 1 + (*pos == '\r');
+            continue;
+        }
+        if (rows == cap) {
+            cap = cap ? cap * 2 : 65536;
+            for (int v = 0; v < prog.nvars; v++) {
+                if (owner[v] != v)
+                    continue;
+
+                double *col = realloc(cols[v], cap * sizeof(double));
+
+                if (!col)
+                    goto oom;
+                cols[v] = col;
+            }
+        }
+        for (int v = 0; v < prog.nvars; v++)
+            if (owner[v] == v)
+                cols[v][rows] = NAN;
+        for (int c = 0; c <= last_column && *pos && *pos != '\n'; c++) {
+            double value;
+
+            if (wanted[c] >= 0) {
+                if (csv_number(&pos, &value) < 0)
+                    value = NAN; // "12abc" is bad, not 12
+                cols[wanted[c]][rows] = value;
+            } else {
+                while (*pos && *pos != ',' && *pos != '\n')
+                    pos++;
+            }
+            if (*pos == ',')
+                pos++;
+        }
+        while (*pos && *pos != '\n')
+            pos++;
+        if (*pos)
+            pos++;
+        rows++;
+    }
+    parsed = now_seconds();
+
+    // Constants are broadcast into chunk-sized registers once; the
+    // variables point straight into the column arrays
+    scratch = malloc((size_t)(prog.nregs - prog.nvars + 1) * COLUMN_CHUNK * sizeof(double));
+    if (!scratch)
+        goto oom;
+    for (int r = prog.nvars; r < prog.nregs; r++)
+        regs[r] = scratch + (size_t)(r - prog.nvars) * COLUMN_CHUNK;
+    for (int k = 0; k < prog.nconsts; k++)
+        for (int i = 0; i < COLUMN_CHUNK; i++)
+            regs[prog.nvars + k][i] = prog.consts[k];
+
+    // Compiled code keeps a row in registers from start to finish, which
+    // beats a pass per instruction once there are enough instructions. The
+    // first chunks alternate between the two and the faster one does the
+    // rest; without the JIT every chunk is interpreted.
+    double jit_rows[COLUMN_CHUNK], spent[2] = { 0, 0 };
+    int jit_faster = 0;
+    const char *why;
+
+    jit_compile(&prog, &jit, &why);
+
+    double sum = 0, min = NAN, max = NAN;
+    long count = 0;
+    char *out = NULL;
+    size_t out_cap = 0;
+
+    if (!aggregates && (grow(&out, &out_cap, COLUMN_CHUNK * 32) < 0))
+        goto oom;
+    for (long row = 0; row < rows; row += COLUMN_CHUNK) {
+        int n = rows - row < COLUMN_CHUNK ? rows - row : COLUMN_CHUNK;
+
+        long chunk = row / COLUMN_CHUNK;
+        int trial = jit.fn && chunk < JIT_TRIAL_CHUNKS;
+        int use_jit = trial ? chunk & 1 : jit_faster;
+        double chunk_start = trial ? now_seconds() : 0;
+
+        for (int v = 0; v < prog.nvars; v++)
+            regs[v] = cols[owner[v]] + row;
+        if (use_jit) {
+            double args[JIT_ARGS] = { 0 };
+
+            for (int i = 0; i < n; i++) {
+                for (int v = 0; v < prog.nvars; v++)
+                    args[v] = regs[v][i];
+                jit_rows[i] = jit_run(&jit, args);
+            }
+        } else {
+            for (const Instr *in = prog.code, *end = in + prog.len; in < end; in++)
+                column_op(in->op, regs[in->dst], regs[in->a], regs[in->b], n);
+        }
+        if (trial) {
+            spent[use_jit] += now_seconds() - chunk_start;
+            if (chunk == JIT_TRIAL_CHUNKS - 1 && spent[1] < spent[0]) {
+                jit_faster = 1;
+                op_name = "jit";
+            }
+        }
+
+        const double *result = use_jit ? jit_rows : regs[prog.result];
+
+        if (aggregates) {
+            // Rows with a missing field come out NaN and are left out
+            for (int i = 0; i < n; i++) {
+                if (isnan(result[i]))
+                    continue;
+                sum += result[i];
+                min = fmin(min, result[i]);
+                max = fmax(max, result[i]);
+                count++;
+            }
+        } else {
+            size_t len = 0;
+
+            for (int i = 0; i < n; i++) {
+                len += format_number(result[i], out + len);
+                out[len++] = '\n';
+            }
+            fwrite(out, 1, len, stdout);
+        }
+    }
+    free(out);
+    fflush(stdout);
+    elapsed = now_seconds() - parsed;
+
+    char number[40];
+
+    if (aggregates & AGG_SUM)
+        printf("sum  %.*s\n", format_number(sum, number), number);
+    if (aggregates & AGG_MIN)
+        printf("min  %.*s\n", format_number(min, number), number);
+    if (aggregates & AGG_MAX)
+        printf("max  %.*s\n", format_number(max, number), number);
+    if (aggregates & AGG_MEAN)
+        printf("mean %.*s\n", format_number(count ? sum / count : NAN, number), number);
+    if (aggregates)
+        printf("rows %ld of %ld\n", count, rows);
+    fprintf(stderr, "%ld rows, %.1f MB: parse %.3f s, evaluate %.3f s (%.1f M rows/s, %s)\n",
+            rows, size / 1e6, parsed - start, elapsed, rows / elapsed / 1e6, op_name);
+    status = 0;
+    goto out;
+
+oom:
+    fprintf(stderr, "Error: Out of memory\n");
+out:
+    for (int v = 0; v < prog.nvars; v++)
+        free(cols[v]); // only owners have one
+    free(wanted);
+    free(scratch);
+    free(data);
+    jit_free(&jit);
+    program_free(&prog);
+    return status;
+}
+
+// Exact mode: arbitrary precision integers and decimals. A Nat is a
+// natural number in base 2^32 limbs, least significant first, with no
+// leading zero limbs (zero has n == 0).
+#define KARATSUBA_THRESHOLD 32     // limbs; smaller products are schoolbook
+#define NTT_THRESHOLD 8192         // limbs; larger products use the NTT
+#define NTT_MAX_SIZE (1 << 23)     // the largest transform every prime allows
+#define CONVERT_THRESHOLD 32       // limbs; smaller values convert digit by digit
+
+typedef struct {
+    uint32_t *d;
+    size_t n;
+} Nat;
+
+static void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+
+    if (!p) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static Nat nat_new(size_t n) {
+    return (Nat){ xcalloc(n, sizeof(uint32_t)), n };
+}
+
+static void nat_free(Nat *a) {
+    free(a->d);
+    a->d = NULL;
+    a->n = 0;
+}
+
+static Nat nat_trim(Nat a) {
+    while (a.n && !a.d[a.n - 1])
+        a.n--;
+    return a;
+}
+
+static Nat nat_from_u64(uint64_t v) {
+    Nat a = nat_new(2);
+
+    a.d[0] = (uint32_t)v;
+    a.d[1] = v >> 32;
+    return nat_trim(a);
+}
+
+static Nat nat_copy(Nat a) {
+    Nat r = nat_new(a.n);
+
+    memcpy(r.d, a.d, a.n * sizeof(uint32_t));
+    return r;
+}
+
+static size_t nat_bits(Nat a) {
+    return a.n ? a.n * 32 - __builtin_clz(a.d[a.n - 1]) : 0;
+}
+
+static int nat_cmp(Nat a, Nat b) {
+    if (a.n != b.n)
+        return a.n < b.n ? -1 : 1;
+    for (size_t i = a.n; i-- > 0;)
+        if (a.d[i] != b.d[i])
+            return a.d[i] < b.d[i] ? -1 : 1;
+    return 0;
+}
+
+// r[0..rn) += a[0..an), an <= rn. Returns the carry out of r.
+static uint32_t add_raw(uint32_t *r, size_t rn, const uint32_t *a, size_t an) {
+    uint64_t carry = 0;
+    size_t i = 0;
+
+    for (; i < an; i++) {
+        carry += (uint64_t)r[i] + a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry && i < rn; i++) {
+        carry += r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return carry;
+}
+
+// r[0..rn) -= a[0..an), an <= rn. Returns the borrow out of r.
+static uint32_t sub_raw(uint32_t *r, size_t rn, const uint32_t *a, size_t an) {
+    uint32_t borrow = 0;
+    size_t i = 0;
+
+    for (; i < an; i++) {
+        uint64_t diff = (uint64_t)r[i] - a[i] - borrow;
+
+        r[i] = (uint32_t)diff;
+        borrow = diff >> 63;
+    }
+    for (; borrow && i < rn; i++)
+        borrow = r[i]-- == 0;
+    return borrow;
+}
+
+static Nat nat_add(Nat a, Nat b) {
+    if (a.n < b.n) {
+        Nat t = a;
+        a = b;
+        b = t;
+    }
+
+    Nat r = nat_new(a.n + 1);
+
+    memcpy(r.d, a.d, a.n * sizeof(uint32_t));
+    r.d[a.n] = add_raw(r.d, a.n, b.d, b.n);
+    return nat_trim(r);
+}
+
+// Function to return a - b, which must not be negative
+static Nat nat_sub(Nat a, Nat b) {
+    Nat r = nat_copy(a);
+
+    sub_raw(r.d, r.n, b.d, b.n);
+    return nat_trim(r);
+}
+
+static Nat nat_shl(Nat a, size_t bits) {
+    size_t limbs = bits / 32, shift = bits % 32;
+    Nat r = nat_new(a.n + limbs + 1);
+
+    for (size_t i = 0; i < a.n; i++) {
+        r.d[i + limbs] |= a.d[i] << shift;
+        if (shift)
+            r.d[i + limbs + 1] = a.d[i] >> (32 - shift);
+    }
+    return nat_trim(r);
+}
+
+static Nat nat_shr(Nat a, size_t bits) {
+    size_t limbs = bits / 32, shift = bits % 32;
+
+    if (limbs >= a.n)
+        return nat_new(0);
+
+    Nat r = nat_new(a.n - limbs);
+
+    for (size_t i = 0; i < r.n; i++) {
+        r.d[i] = a.d[i + limbs] >> shift;
+        if (shift && i + limbs + 1 < a.n)
+            r.d[i] |= a.d[i + limbs + 1] << (32 - shift);
+    }
+    return nat_trim(r);
+}
+
+static Nat nat_pow2(size_t bits) {
+    Nat r = nat_new(bits / 32 + 1);
+
+    r.d[bits / 32] = 1u << (bits % 32);
+    return r;
+}
+
+static void mul_school(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    memset(out, 0, (na + nb) * sizeof(uint32_t));
+    for (size_t i = 0; i < nb; i++) {
+        uint64_t carry = 0;
+
+        for (size_t j = 0; j < na; j++) {
+            carry += (uint64_t)a[j] * b[i] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + na] = carry;
+    }
+}
+
+// Number theoretic transform over three primes below 2^30. Products are
+// split into 16-bit pieces, so each convolution term stays below
+// 2^32 * NTT_MAX_SIZE, well under the product of the primes, and the
+// three residues pin it down exactly. Arithmetic is in Montgomery form.
+typedef struct {
+    uint32_t mod;
+    uint32_t mprime;           // -mod^-1 mod 2^32
+    uint32_t r2;               // 2^64 mod mod, to enter Montgomery form
+} NttPrime;
+
+#define NTT_P1 998244353u
+#define NTT_P2 469762049u
+#define NTT_P3 167772161u
+
+static NttPrime ntt_primes[3] = { { .mod = NTT_P1 }, { .mod = NTT_P2 }, { .mod = NTT_P3 } }; // 3 generates all three
+
+static inline uint32_t mont_reduce(uint64_t t, uint32_t mod, uint32_t mprime) {
+    uint32_t u = (uint32_t)t * mprime;
+    uint32_t r = (t + (uint64_t)u * mod) >> 32;
+
+    return r >= mod ? r - mod : r;
+}
+
+static inline uint32_t mont_mul(uint32_t a, uint32_t b, const NttPrime *p) {
+    return mont_reduce((uint64_t)a * b, p->mod, p->mprime);
+}
+
+static uint32_t pow_mod(uint64_t base, uint64_t e, uint32_t mod) {
+    uint64_t r = 1;
+
+    for (base %= mod; e; e >>= 1, base = base * base % mod)
+        if (e & 1)
+            r = r * base % mod;
+    return r;
+}
+
+static void ntt_init(void) {
+    for (int k = 0; k < 3; k++) {
+        NttPrime *p = &ntt_primes[k];
+        uint32_t inv = p->mod;
+        uint64_t r1 = (1ULL << 32) % p->mod;
+
+        for (int i = 0; i < 5; i++)
+            inv *= 2 - p->mod * inv; // Newton: doubles the correct bits
+        p->mprime = -inv;
+        p->r2 = r1 * r1 % p->mod;
+    }
+}
+
+static void ntt(uint32_t *a, size_t n, const NttPrime *p, int invert, uint32_t *twiddle) {
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            uint32_t t = a[i];
+            a[i] = a[j];
+            a[j] = t;
+        }
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+        size_t half = len / 2;
+        uint32_t w = pow_mod(3, (p->mod - 1) / len, p->mod);
+
+        if (invert)
+            w = pow_mod(w, p->mod - 2, p->mod);
+        w = mont_mul(w, p->r2, p);
+        twiddle[0] = mont_mul(1, p->r2, p);
+        for (size_t k = 1; k < half; k++)
+            twiddle[k] = mont_mul(twiddle[k - 1], w, p);
+
+        // Locals: a[] could alias *p as far as the compiler knows
+        const uint32_t mod = p->mod, mprime = p->mprime;
+
+        for (size_t i = 0; i < n; i += len) {
+            uint32_t *lo = a + i, *hi = a + i + half;
+
+            for (size_t k = 0; k < half; k++) {
+                uint32_t u = lo[k], v = mont_reduce((uint64_t)hi[k] * twiddle[k], mod, mprime);
+
+                lo[k] = u + v >= mod ? u + v - mod : u + v;
+                hi[k] = u >= v ? u - v : u + mod - v;
+            }
+        }
+    }
+}
+
+static void mul_ntt(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out, size_t size) {
+    uint32_t *residues[3], *twiddle = xcalloc(size / 2, sizeof(uint32_t));
+
+    if (!ntt_primes[0].mprime)
+        ntt_init();
+
+    for (int k = 0; k < 3; k++) {
+        const NttPrime *p = &ntt_primes[k];
+        uint32_t *fa = xcalloc(size, sizeof(uint32_t)), *fb = xcalloc(size, sizeof(uint32_t));
+        uint32_t scale = pow_mod(size, p->mod - 2, p->mod);
+
+        for (size_t i = 0; i < na; i++) {
+            fa[2 * i] = mont_mul(a[i] & 0xFFFF, p->r2, p);
+            fa[2 * i + 1] = mont_mul(a[i] >> 16, p->r2, p);
+        }
+        for (size_t i = 0; i < nb; i++) {
+            fb[2 * i] = mont_mul(b[i] & 0xFFFF, p->r2, p);
+            fb[2 * i + 1] = mont_mul(b[i] >> 16, p->r2, p);
+        }
+        ntt(fa, size, p, 0, twiddle);
+        ntt(fb, size, p, 0, twiddle);
+        for (size_t i = 0; i < size; i++)
+            fa[i] = mont_mul(fa[i], fb[i], p);
+        ntt(fa, size, p, 1, twiddle);
+        for (size_t i = 0; i < size; i++)
+            fa[i] = mont_mul(fa[i], scale, p); // also leaves Montgomery form
+        free(fb);
+        residues[k] = fa;
+    }
+
+    // Garner: x = v1 + v2 p1 + v3 p1 p2
+    const uint64_t p1 = NTT_P1, p2 = NTT_P2, p3 = NTT_P3; // constant, so % compiles to multiplies
+    uint64_t inv_p1_p2 = pow_mod(p1, p2 - 2, p2);
+    uint64_t inv_p1p2_p3 = pow_mod(p1 * p2 % p3, p3 - 2, p3);
+    unsigned __int128 carry = 0;
+
+    for (size_t i = 0; i < 2 * (na + nb); i++) {
+        uint64_t v1 = residues[0][i];
+        uint64_t v2 = (residues[1][i] + p2 - v1 % p2) * inv_p1_p2 % p2;
+        uint64_t v3 = (residues[2][i] + p3 - (v1 + v2 * p1) % p3) * inv_p1p2_p3 % p3;
+
+        carry += v1 + (unsigned __int128)v2 * p1 + (unsigned __int128)v3 * p1 * p2;
+        if (i & 1)
+            out[i / 2] |= (uint32_t)(carry & 0xFFFF) << 16;
+        else
+            out[i / 2] = carry & 0xFFFF;
+        carry >>= 16;
+    }
+
+    for (int k = 0; k < 3; k++)
+        free(residues[k]);
+    free(twiddle);
+}
+
+// Function to set out[0..na+nb) to a * b: schoolbook, then Karatsuba,
+// then the NTT as the operands grow
+static void mul_raw(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    if (na < nb) {
+        const uint32_t *t = a;
+        size_t tn = na;
+
+        a = b;
+        na = nb;
+        b = t;
+        nb = tn;
+    }
+
+    size_t size = 1;
+
+    while (size < 2 * (na + nb))
+        size <<= 1;
+
+    if (nb < KARATSUBA_THRESHOLD) {
+        mul_school(a, na, b, nb, out);
+    } else if (nb >= NTT_THRESHOLD && size <= NTT_MAX_SIZE) {
+        mul_ntt(a, na, b, nb, out, size);
+    } else if (na >= 2 * nb) {
+        // Lopsided: multiply b by one nb-limb slice of a at a time
+        uint32_t *t = xcalloc(2 * nb, sizeof(uint32_t));
+
+        memset(out, 0, (na + nb) * sizeof(uint32_t));
+        for (size_t i = 0; i < na; i += nb) {
+            size_t len = na - i < nb ? na - i : nb;
+
+            mul_raw(a + i, len, b, nb, t);
+            add_raw(out + i, na + nb - i, t, len + nb);
+        }
+        free(t);
+    } else {
+        // a = a1 B^h + a0, b = b1 B^h + b0, and nb > h
+        size_t h = na / 2, na1 = na - h, nb1 = nb - h;
+        size_t ns = na1 + 1, ms = (h > nb1 ? h : nb1) + 1, nz = ns + ms;
+        uint32_t *sa = xcalloc(ns, sizeof(uint32_t));
+        uint32_t *sb = xcalloc(ms, sizeof(uint32_t));
+        uint32_t *z1 = xcalloc(nz, sizeof(uint32_t));
+
+        mul_raw(a, h, b, h, out);                       // z0 = a0 b0
+        mul_raw(a + h, na1, b + h, nb1, out + 2 * h);   // z2 = a1 b1
+
+        memcpy(sa, a + h, na1 * sizeof(uint32_t));
+        add_raw(sa, ns, a, h);
+        memcpy(sb, b, h * sizeof(uint32_t));
+        add_raw(sb, ms, b + h, nb1);
+        mul_raw(sa, ns, sb, ms, z1);                    // (a0 + a1)(b0 + b1)
+        sub_raw(z1, nz, out, 2 * h);
+        sub_raw(z1, nz, out + 2 * h, na1 + nb1);
+
+        // z1 = a0 b1 + a1 b0 fits below B^(na + nb - h); the rest is zero
+        add_raw(out + h, na + nb - h, z1, nz < na + nb - h ? nz : na + nb - h);
+        free(sa);
+        free(sb);
+        free(z1);
+    }
+}
+
+static Nat nat_mul(Nat a, Nat b) {
+    Nat r = nat_new(a.n + b.n);
+
+    if (a.n && b.n)
+        mul_raw(a.d, a.n, b.d, b.n, r.d);
+    return nat_trim(r);
+}
+
+// Function to divide a by d in place. Returns the remainder.
+static uint32_t nat_divmod_small(Nat *a, uint32_t d) {
+    uint64_t rem = 0;
+
+    for (size_t i = a->n; i-- > 0;) {
+        uint64_t cur = rem << 32 | a->d[i];
+
+        a->d[i] = cur / d;
+        rem = cur % d;
+    }
+    *a = nat_trim(*a);
+    return rem;
+}
+
+// Function to return about 2^2n / b, within a few units, for b of exactly
+// n bits. Newton iteration: a reciprocal of the top half of b, lifted and
+// refined by one step x += x (2^2n - b x) / 2^2n, which doubles the
+// correct bits. Callers correct the last units themselves.
+static Nat nat_inverse(Nat b, size_t n) {
+    if (n <= 60) {
+        uint64_t v = b.d[0] | (b.n > 1 ? (uint64_t)b.d[1] << 32 : 0);
+        unsigned __int128 q = ((unsigned __int128)1 << (2 * n)) / v;
+        Nat r = nat_new(4);
+
+        for (int i = 0; i < 4; i++)
+            r.d[i] = (uint32_t)(q >> (32 * i));
+        return nat_trim(r);
+    }
+
+    size_t h = n / 2 + 4; // guard bits keep the error to a few units
+    Nat top = nat_shr(b, n - h);
+    Nat y = nat_inverse(top, h);
+    Nat x = nat_shl(y, n - h);
+    Nat one = nat_pow2(2 * n);
+    Nat bx = nat_mul(b, x);
+    int over = nat_cmp(bx, one) > 0;
+    Nat e = over ? nat_sub(bx, one) : nat_sub(one, bx); // about n - h bits
+    Nat xe = nat_mul(x, e);
+    Nat step = nat_shr(xe, 2 * n);
+    Nat r = over ? nat_sub(x, step) : nat_add(x, step);
+
+    nat_free(&top);
+    nat_free(&y);
+    nat_free(&x);
+    nat_free(&one);
+    nat_free(&bx);
+    nat_free(&e);
+    nat_free(&xe);
+    nat_free(&step);
+    return r;
+}
+
+// Function to finish a division given x, about 2^shift / b: q starts as
+// a x / 2^shift and is moved the last few units until 0 <= r < b
+static void nat_divmod_with(Nat a, Nat b, Nat x, size_t shift, Nat *q, Nat *r) {
+    Nat ax = nat_mul(a, x);
+    Nat qb, one = nat_from_u64(1);
+
+    *q = nat_shr(ax, shift);
+    qb = nat_mul(*q, b);
+    nat_free(&ax);
+
+    while (nat_cmp(qb, a) > 0) {
+        Nat t = nat_sub(*q, one), u = nat_sub(qb, b);
+
+        nat_free(q);
+        nat_free(&qb);
+        *q = t;
+        qb = u;
+    }
+    *r = nat_sub(a, qb);
+    nat_free(&qb);
+
+    while (nat_cmp(*r, b) >= 0) {
+        Nat t = nat_add(*q, one), u = nat_sub(*r, b);
+
+        nat_free(q);
+        nat_free(r);
+        *q = t;
+        *r = u;
+    }
+    nat_free(&one);
+}
+
+// Function to divide a by b (not zero): q = floor(a / b), r = a - q b.
+// With p the bits of a and n those of b, the quotient has about p - n
+// bits, so b is scaled up to m >= p - n bits and one reciprocal of that
+// precision covers it.
+static void nat_divmod(Nat a, Nat b, Nat *q, Nat *r) {
+    size_t n = nat_bits(b), p = nat_bits(a);
+
+    if (p < n) {
+        *q = nat_new(0);
+        *r = nat_copy(a);
+        return;
+    }
+    if (b.n == 1) {
+        *q = nat_copy(a);
+        *r = nat_from_u64(nat_divmod_small(q, b.d[0]));
+        return;
+    }
+
+    size_t m = p - n > n ? p - n : n;
+    Nat scaled = nat_shl(b, m - n);
+    Nat x = nat_inverse(scaled, m); // about 2^(m+n) / b
+
+    nat_divmod_with(a, b, x, m + n, q, r);
+    nat_free(&scaled);
+    nat_free(&x);
+}
+
+// Powers 10^(9 * 2^k), built by squaring as base conversion needs them
+static Nat decimal_powers[48];
+
+static Nat decimal_power(int k) {
+    if (!decimal_powers[k].d)
+        decimal_powers[k] = k ? nat_mul(decimal_power(k - 1), decimal_power(k - 1)) : nat_from_u64(1000000000);
+    return decimal_powers[k];
+}
+
+// Function to divide a, below decimal_power(k)^2, by decimal_power(k).
+// Printing divides by each power many times, so its reciprocal is kept.
+static void decimal_divmod(Nat a, int k, Nat *q, Nat *r) {
+    static Nat inverses[48];
+    Nat b = decimal_power(k);
+    size_t n = nat_bits(b);
+
+    if (!inverses[k].d)
+        inverses[k] = nat_inverse(b, n);
+    nat_divmod_with(a, b, inverses[k], 2 * n, q, r);
+}
+
+// Function to parse len decimal digits. Above the threshold the digits
+// split at a 10^(9 * 2^k) boundary: value = high * 10^(9 * 2^k) + low.
+static Nat nat_from_decimal(const char *digits, size_t len) {
+    if (len <= 9 * CONVERT_THRESHOLD) {
+        Nat r = nat_new(len / 9 + 2);
+        size_t used = 0;
+
+        for (size_t i = 0; i < len;) {
+            size_t chunk = (len - i) % 9 ? (len - i) % 9 : 9;
+            uint64_t carry = 0, scale = 1;
+
+            for (size_t j = 0; j < chunk; j++, i++) {
+                carry = carry * 10 + (digits[i] - '0');
+                scale *= 10;
+            }
+            for (size_t j = 0; j < used; j++) {
+                carry += (uint64_t)r.d[j] * scale;
+                r.d[j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            if (carry)
+                r.d[used++] = carry;
+        }
+        return nat_trim(r);
+    }
+
+    int k = 0;
+
+    while (9ul << (k + 1) < len)
+        k++;
+
+    size_t low_len = 9ul << k;
+    Nat high = nat_from_decimal(digits, len - low_len);
+    Nat low = nat_from_decimal(digits + len - low_len, low_len);
+    Nat shifted = nat_mul(high, decimal_power(k));
+    Nat r = nat_add(shifted, low);
+
+    nat_free(&high);
+    nat_free(&low);
+    nat_free(&shifted);
+    return r;
+}
+
+// Function to write a, known to be below 10^(9 * 2^k), in decimal. With
+// width, writes exactly that many digits, zero padded; otherwise no
+// leading zeros. Returns the digits written. Above the threshold a splits
+// as a = q 10^(9 * 2^(k-1)) + r, with both halves converted recursively.
+static size_t nat_write_decimal(Nat a, int k, char *out, size_t width) {
+    if (k == 0 || a.n <= CONVERT_THRESHOLD) {
+        Nat t = nat_copy(a);
+        char *buf = xcalloc(a.n * 10 + 10, 1);
+        size_t len = 0;
+
+        do {
+            uint32_t group = nat_divmod_small(&t, 1000000000);
+
+            for (int i = 0; i < 9; i++, group /= 10)
+                buf[len++] = '0' + group % 10;
+        } while (t.n);
+        while (len > 1 && buf[len - 1] == '0')
+            len--;
+        if (width && len > width)
+            len = width; // only zeros past the width
+        if (!width)
+            width = len;
+        memset(out, '0', width - len);
+        for (size_t i = 0; i < len; i++)
+            out[width - 1 - i] = buf[i];
+        nat_free(&t);
+        free(buf);
+        return width;
+    }
+
+    Nat q, r;
+    size_t half = 9ul << (k - 1), len;
+
+    decimal_divmod(a, k - 1, &q, &r);
+    if (width) {
+        nat_write_decimal(q, k - 1, out, width - half);
+        nat_write_decimal(r, k - 1, out + width - half, half);
+        len = width;
+    } else if (!q.n) {
+        len = nat_write_decimal(r, k - 1, out, 0);
+    } else {
+        len = nat_write_decimal(q, k - 1, out, 0);
+        len += nat_write_decimal(r, k - 1, out + len, half);
+    }
+    nat_free(&q);
+    nat_free(&r);
+    return len;
+}
+
+// Function to return a in decimal, NUL terminated. Free the result.
+static char *nat_to_decimal(Nat a, size_t *len) {
+    int k = 0;
+
+    while (nat_bits(decimal_power(k)) <= nat_bits(a))
+        k++;
+
+    char *out = xcalloc((9ul << k) + 1, 1);
+
+    *len = nat_write_decimal(a, k, out, 0);
+    out[*len] = '\0';
+    return out;
+}
+
+// A decimal is mag / 10^scale, with a sign
+typedef struct {
+    int negative;
+    Nat mag;
+    long scale;
+} Decimal;
+
+typedef struct {
+    const char *pos;
+    const char *error;
+    const char *error_at;
+    long digits;               // fraction digits division keeps
+    int depth;
+} ExactParser;
+
+static void dec_free(Decimal *a) {
+    nat_free(&a->mag);
+}
+
+static Nat nat_pow10(unsigned long k) {
+    Nat r = nat_from_u64(1), base = nat_from_u64(10);
+
+    for (; k; k >>= 1) {
+        if (k & 1) {
+            Nat t = nat_mul(r, base);
+
+            nat_free(&r);
+            r = t;
+        }
+        if (k > 1) {
+            Nat t = nat_mul(base, base);
+
+            nat_free(&base);
+            base = t;
+        }
+    }
+    nat_free(&base);
+    return r;
+}
+
+static Nat nat_mul_pow10(Nat a, unsigned long k) {
+    Nat p = nat_pow10(k), r = nat_mul(a, p);
+
+    nat_free(&p);
+    return r;
+}
+
+static uint32_t nat_mod_small(Nat a, uint32_t d) {
+    uint64_t rem = 0;
+
+    for (size_t i = a.n; i-- > 0;)
+        rem = (rem << 32 | a.d[i]) % d;
+    return rem;
+}
+
+// Function to drop trailing zeros after the decimal point. Long runs of
+// zeros come off a 10^(9 * 2^k) at a time, largest first, so a run costs
+// a few big divisions instead of a pass over the number per digit.
+static void dec_normalize(Decimal *a) {
+    if (a->scale > 0 && a->mag.n && !(a->mag.d[0] & 1) && !nat_mod_small(a->mag, 10)) {
+        size_t bits = nat_bits(a->mag);
+        int k = 0;
+
+        while (k < 47 && (9L << (k + 1)) <= a->scale && (30UL << (k + 1)) <= bits)
+            k++;
+        for (; k >= 0; k--) {
+            while (a->scale >= (9L << k) && nat_cmp(decimal_power(k), a->mag) <= 0) {
+                Nat q, r;
+                int exact;
+
+                nat_divmod(a->mag, decimal_power(k), &q, &r);
+                exact = !r.n;
+                nat_free(&r);
+                if (!exact) {
+                    nat_free(&q);
+                    break;
+                }
+                nat_free(&a->mag);
+                a->mag = q;
+                a->scale -= 9L << k;
+            }
+        }
+    }
+
+    // Fewer than 9 zeros left
+    while (a->scale > 0 && a->mag.n && !nat_mod_small(a->mag, 10)) {
+        nat_divmod_small(&a->mag, 10);
+        a->scale--;
+    }
+    if (!a->mag.n) {
+        a->negative = 0;
+        a->scale = 0;
+    }
+}
+
+// Function to bring a and b to the same scale, as new magnitudes
+static long dec_align(const Decimal *a, const Decimal *b, Nat *ma, Nat *mb) {
+    long scale = a->scale > b->scale ? a->scale : b->scale;
+
+    *ma = nat_mul_pow10(a->mag, scale - a->scale);
+    *mb = nat_mul_pow10(b->mag, scale - b->scale);
+    return scale;
+}
+
+static Decimal dec_add(const Decimal *a, const Decimal *b, int subtract) {
+    Decimal r = { 0 };
+    Nat ma, mb;
+    int b_negative = b->negative ^ subtract;
+
+    r.scale = dec_align(a, b, &ma, &mb);
+    if (a->negative == b_negative) {
+        r.mag = nat_add(ma, mb);
+        r.negative = a->negative;
+    } else if (nat_cmp(ma, mb) >= 0) {
+        r.mag = nat_sub(ma, mb);
+        r.negative = a->negative;
+    } else {
+        r.mag = nat_sub(mb, ma);
+        r.negative = b_negative;
+    }
+    nat_free(&ma);
+    nat_free(&mb);
+    dec_normalize(&r);
+    return r;
+}
+
+static Decimal dec_mul(const Decimal *a, const Decimal *b) {
+    Decimal r = { a->negative ^ b->negative, nat_mul(a->mag, b->mag), a->scale + b->scale };
+
+    dec_normalize(&r);
+    return r;
+}
+
+// Function to divide to the given number of fraction digits, rounding
+// half away from zero
+static Decimal dec_div(const Decimal *a, const Decimal *b, long digits) {
+    Decimal r = { a->negative ^ b->negative, { NULL, 0 }, digits };
+    long shift = digits + b->scale - a->scale;
+    Nat num = shift > 0 ? nat_mul_pow10(a->mag, shift) : nat_copy(a->mag);
+    Nat den = shift < 0 ? nat_mul_pow10(b->mag, -shift) : nat_copy(b->mag);
+    Nat rem, twice;
+
+    nat_divmod(num, den, &r.mag, &rem);
+    twice = nat_shl(rem, 1);
+    if (nat_cmp(twice, den) >= 0) {
+        Nat one = nat_from_u64(1), t = nat_add(r.mag, one);
+
+        nat_free(&r.mag);
+        nat_free(&one);
+        r.mag = t;
+    }
+    nat_free(&num);
+    nat_free(&den);
+    nat_free(&rem);
+    nat_free(&twice);
+    dec_normalize(&r);
+    return r;
+}
+
+// Function for a % b, taking the sign of a like C's fmod
+static Decimal dec_mod(const Decimal *a, const Decimal *b) {
+    Decimal r = { a->negative, { NULL, 0 }, 0 };
+    Nat ma, mb, q;
+
+    r.scale = dec_align(a, b, &ma, &mb);
+    nat_divmod(ma, mb, &q, &r.mag);
+    nat_free(&ma);
+    nat_free(&mb);
+    nat_free(&q);
+    dec_normalize(&r);
+    return r;
+}
+
+static char *dec_to_string(const Decimal *a) {
+    size_t len, pad;
+    char *digits = nat_to_decimal(a->mag, &len);
+    char *out = xcalloc(len + a->scale + 4, 1), *p = out;
+
+    if (a->negative)
+        *p++ = '-';
+    if ((long)len <= a->scale) {
+        pad = a->scale - len;
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', pad);
+        memcpy(p + pad, digits, len);
+    } else {
+        memcpy(p, digits, len - a->scale);
+        p += len - a->scale;
+        if (a->scale) {
+            *p++ = '.';
+            memcpy(p, digits + len - a->scale, a->scale);
+        }
+    }
+    free(digits);
+    return out;
+}
+
+static int exact_fail(ExactParser *p, const char *error) {
+    if (!p->error) {
+        p->error = error;
+        p->error_at = p->pos;
+    }
+    return -1;
+}
+
+static int exact_sum(ExactParser *p, Decimal *out);
+
+static void exact_skip_space(ExactParser *p) {
+    while (isspace((unsigned char)*p->pos))
+        p->pos++;
+}
+
+// Function to read digits[.digits][e[+-]digits] exactly
+static int exact_number(ExactParser *p, Decimal *out) {
+    const char *start = p->pos;
+    char *digits = xcalloc(strlen(start) + 1, 1);
+    size_t len = 0;
+    long exponent = 0;
+
+    for (; isdigit((unsigned char)*p->pos); p->pos++)
+        digits[len++] = *p->pos;
+    if (*p->pos == '.')
+        for (p->pos++; isdigit((unsigned char)*p->pos); p->pos++, exponent--)
+            digits[len++] = *p->pos;
+    if ((*p->pos == 'e' || *p->pos == 'E') &&
+        (isdigit((unsigned char)p->pos[1]) || ((p->pos[1] == '-' || p->pos[1] == '+') && isdigit((unsigned char)p->pos[2])))) {
+        char *end;
+        long e = strtol(p->pos + 1, &end, 10);
+
+        if (e > 100000000 || e < -100000000) {
+            free(digits);
+            return exact_fail(p, "Exponent too large");
+        }
+        exponent += e;
+        p->pos = end;
+    }
+
+    size_t skip = strspn(digits, "0");
+
+    out->negative = 0;
+    out->mag = nat_from_decimal(digits + skip, len - skip);
+    out->scale = -exponent;
+    free(digits);
+    if (out->scale < 0) {
+        Nat t = nat_mul_pow10(out->mag, -out->scale);
+
+        nat_free(&out->mag);
+        out->mag = t;
+        out->scale = 0;
+    }
+    dec_normalize(out);
+    return 0;
+}
+
+static int exact_primary(ExactParser *p, Decimal *out) {
+    exact_skip_space(p);
+    if (isdigit((unsigned char)*p->pos) || (*p->pos == '.' && isdigit((unsigned char)p->pos[1]))) {
+        if (exact_number(p, out) < 0)
+            return -1;
+    } else if (*p->pos == '(') {
+        p->pos++;
+        if (exact_sum(p, out) < 0)
+            return -1;
+        if (*p->pos != ')') {
+            dec_free(out);
+            return exact_fail(p, "Expected ')'");
+        }
+        p->pos++;
+    } else if (isalpha((unsigned char)*p->pos)) {
+        return exact_fail(p, "Names aren't available in exact mode");
+    } else {
+        return exact_fail(p, *p->pos ? "Unexpected character" : "Unexpected end of expression");
+    }
+    exact_skip_space(p);
+    return 0;
+}
+
+// Function to raise base to an integer power by squaring. Negative powers
+// divide 1 by the positive one.
+static int exact_power(ExactParser *p, Decimal *base, Decimal *power, const char *at) {
+    Decimal r = { 0, nat_from_u64(1), 0 }, b = { base->negative, nat_copy(base->mag), base->scale };
+
+    if (power->scale || power->mag.n > 1) {
+        dec_free(&r);
+        dec_free(&b);
+        p->pos = at;
+        return exact_fail(p, "Exponent must be an integer below 2^32");
+    }
+    for (uint32_t e = power->mag.n ? power->mag.d[0] : 0; e; e >>= 1) {
+        if (e & 1) {
+            Decimal t = dec_mul(&r, &b);
+
+            dec_free(&r);
+            r = t;
+        }
+        if (e > 1) {
+            Decimal t = dec_mul(&b, &b);
+
+            dec_free(&b);
+            b = t;
+        }
+    }
+    dec_free(&b);
+    if (power->negative) {
+        Decimal one = { 0, nat_from_u64(1), 0 };
+
+        if (!r.mag.n) {
+            dec_free(&r);
+            dec_free(&one);
+            p->pos = at;
+            return exact_fail(p, "Division by zero");
+        }
+
+        Decimal t = dec_div(&one, &r, p->digits);
+
+        dec_free(&one);
+        dec_free(&r);
+        r = t;
+    }
+    dec_free(base);
+    *base = r;
+    return 0;
+}
+
+static int exact_unary(ExactParser *p, Decimal *out) {
+    int status;
+
+    if (++p->depth > MAX_DEPTH)
+        return exact_fail(p, "Expression too deeply nested");
+    exact_skip_space(p);
+    if (*p->pos == '-' || *p->pos == '+') {
+        int negate = *p->pos++ == '-';
+
+        status = exact_unary(p, out);
+        if (status == 0 && negate && out->mag.n)
+            out->negative = !out->negative;
+    } else {
+        status = exact_primary(p, out);
+        if (status == 0 && *p->pos == '^') {
+            const char *at = ++p->pos;
+            Decimal power;
+
+            status = exact_unary(p, &power);
+            if (status == 0) {
+                status = exact_power(p, out, &power, at);
+                dec_free(&power);
+            }
+            if (status < 0)
+                dec_free(out);
+        }
+    }
+    p->depth--;
+    return status;
+}
+
+static int exact_product(ExactParser *p, Decimal *out) {
+    if (exact_unary(p, out) < 0)
+        return -1;
+    while (*p->pos == '*' || *p->pos == '/' || *p->pos == '%') {
+        char op = *p->pos++;
+        const char *at = p->pos;
+        Decimal rhs, r;
+
+        if (exact_unary(p, &rhs) < 0) {
+            dec_free(out);
+            return -1;
+        }
+        if (op != '*' && !rhs.mag.n) {
+            dec_free(out);
+            dec_free(&rhs);
+            p->pos = at;
+            return exact_fail(p, "Division by zero");
+        }
+        r = op == '*' ? dec_mul(out, &rhs) : op == '/' ? dec_div(out, &rhs, p->digits) : dec_mod(out, &rhs);
+        dec_free(out);
+        dec_free(&rhs);
+        *out = r;
+    }
+    return 0;
+}
+
+static int exact_sum(ExactParser *p, Decimal *out) {
+    if (exact_product(p, out) < 0)
+        return -1;
+    while (*p->pos == '+' || *p->pos == '-') {
+        int subtract = *p->pos++ == '-';
+        Decimal rhs, r;
+
+        if (exact_product(p, &rhs) < 0) {
+            dec_free(out);
+            return -1;
+        }
+        r = dec_add(out, &rhs, subtract);
+        dec_free(out);
+        dec_free(&rhs);
+        *out = r;
+    }
+    return 0;
+}
+
+static int run_exact(const char *text, long digits) {
+    ExactParser p = { .pos = text, .digits = digits };
+    Decimal result;
+
+    if (exact_sum(&p, &result) == 0 && *p.pos) {
+        dec_free(&result);
+        exact_fail(&p, "Unexpected character");
+    }
+    if (p.error) {
+        print_error(text, p.error, p.error_at - text);
+        return 1;
+    }
+
+    char *s = dec_to_string(&result);
+
+    printf("Result: %s\n", s);
+    free(s);
+    dec_free(&result);
+    return 0;
+}
+
+static const char *mul_method(size_t limbs) {
+    return limbs < KARATSUBA_THRESHOLD ? "schoolbook" : limbs < NTT_THRESHOLD ? "karatsuba" : "ntt";
+}
+
+// Function to time the exact mode at 1K, 100K and 1M digits: parsing,
+// multiplying two n-digit numbers, dividing the product back, and
+// printing. Each step is checked against the one before.
+static void exact_bench(void) {
+    static const long sizes[] = { 1000, 100000, 1000000 };
+    uint32_t rng = 2463534242u;
+
+    printf("%9s %10s %10s %-10s %10s %10s  %s\n", "digits", "parse", "multiply", "", "divide", "print", "check");
+    for (int s = 0; s < 3; s++) {
+        long n = sizes[s];
+        int runs = n <= 1000 ? 1000 : n <= 100000 ? 3 : 1;
+        char *text[2];
+        Nat a = { 0 }, b = { 0 }, product = { 0 }, q = { 0 }, r = { 0 };
+        double t0, t_parse, t_mul, t_div, t_print;
+        size_t len = 0;
+        char *printed = NULL;
+
+        for (int k = 0; k < 2; k++) {
+            text[k] = xcalloc(n + 1, 1);
+            for (long i = 0; i < n; i++) {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+                text[k][i] = '0' + (i ? rng % 10 : 1 + rng % 9);
+            }
+        }
+
+        t0 = now_seconds();
+        for (int i = 0; i < runs; i++) {
+            nat_free(&a);
+            nat_free(&b);
+            a = nat_from_decimal(text[0], n);
+            b = nat_from_decimal(text[1], n);
+        }
+        t_parse = (now_seconds() - t0) / runs / 2;
+
+        t0 = now_seconds();
+        for (int i = 0; i < runs; i++) {
+            nat_free(&product);
+            product = nat_mul(a, b);
+        }
+        t_mul = (now_seconds() - t0) / runs;
+
+        t0 = now_seconds();
+        for (int i = 0; i < runs; i++) {
+            nat_free(&q);
+            nat_free(&r);
+            nat_divmod(product, b, &q, &r);
+        }
+        t_div = (now_seconds() - t0) / runs;
+
+        t0 = now_seconds();
+        for (int i = 0; i < runs; i++) {
+            free(printed);
+            printed = nat_to_decimal(a, &len);
+        }
+        t_print = (now_seconds() - t0) / runs;
+
+        int ok = !nat_cmp(q, a) && !r.n && len == (size_t)n && !memcmp(printed, text[0], n);
+
+        printf("%9ld %8.3f ms %7.3f ms %-10s %7.3f ms %7.3f ms  %s\n", n, t_parse * 1e3, t_mul * 1e3,
+               mul_method(a.n), t_div * 1e3, t_print * 1e3, ok ? "ok" : "MISMATCH");
+        fflush(stdout);
+
+        free(text[0]);
+        free(text[1]);
+        free(printed);
+        nat_free(&a);
+        nat_free(&b);
+        nat_free(&product);
+        nat_free(&q);
+        nat_free(&r);
+    }
+}
+
+// Spreadsheet REPL: named cells defined in terms of each other. Each cell
+// keeps its compiled expression, the cells it reads (deps) and the cells
+// that read it (users). Changing a cell recomputes only what lies
+// downstream of it, in topological order, a level at a time; large levels
+// are split across threads since their cells can't depend on each other.
+#define SHEET_MAGIC "GCALCSH2"
+#define INSTR_BYTES 7              // an Instr as saved: op, then dst, a, b
+#define SHEET_PARALLEL 4096        // cells in a level before it's worth threads
+
+typedef struct {
+    char name[MAX_NAME];
+    char *text;                // definition, or NULL if only referenced
+    Program prog;
+    int *deps;                 // cell behind each of prog's variables
+    int *users;
+    int nusers, users_cap;
+    double value;
+    unsigned int seen;         // walk stamps
+    unsigned int target;
+    int pending;               // dirty inputs left during a recompute
+} Cell;
+
+typedef struct {
+    Cell *cells;
+    int ncells, cap;
+    int *table;                // open addressing: cell index + 1, or 0
+    int table_cap;
+    unsigned int walk;
+    int *stack, *level, *next; // scratch, ncells long
+    int scratch_cap;
+    int threads;
+    long last_updated;
+    double last_update_ms;
+} Sheet;
+
+typedef struct {
+    Sheet *sheet;
+    const int *cells;
+    int count;
+} SheetSlice;
+
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++)
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    return h;
+}
+
+static int sheet_find(const Sheet *s, const char *name) {
+    if (!s->table_cap)
+        return -1;
+    for (uint32_t i = hash_name(name) & (s->table_cap - 1); s->table[i]; i = (i + 1) & (s->table_cap - 1))
+        if (!strcmp(s->cells[s->table[i] - 1].name, name))
+            return s->table[i] - 1;
+    return -1;
+}
+
+static void sheet_index(Sheet *s, int cell) {
+    uint32_t i = hash_name(s->cells[cell].name) & (s->table_cap - 1);
+
+    while (s->table[i])
+        i = (i + 1) & (s->table_cap - 1);
+    s->table[i] = cell + 1;
+}
+
+// Function to make room for n cells
+static void sheet_reserve(Sheet *s, int n) {
+    if (n > s->cap) {
+        s->cap = n;
+        s->cells = realloc(s->cells, s->cap * sizeof(*s->cells));
+        s->stack = realloc(s->stack, s->cap * sizeof(int));
+        s->level = realloc(s->level, s->cap * sizeof(int));
+        s->next = realloc(s->next, s->cap * sizeof(int));
+        if (!s->cells || !s->stack || !s->level || !s->next) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    if (2 * n > s->table_cap) {
+        if (!s->table_cap)
+            s->table_cap = 512;
+        while (2 * n > s->table_cap)
+            s->table_cap *= 2;
+        free(s->table);
+        s->table = xcalloc(s->table_cap, sizeof(int));
+        for (int i = 0; i < s->ncells; i++)
+            sheet_index(s, i);
+    }
+}
+
+// Function to find a cell by name, adding an undefined one if needed
+static int sheet_cell(Sheet *s, const char *name) {
+    int cell = sheet_find(s, name);
+
+    if (cell >= 0)
+        return cell;
+
+    if (s->ncells == s->cap)
+        sheet_reserve(s, s->cap ? s->cap * 2 : 256);
+
+    cell = s->ncells++;
+    memset(&s->cells[cell], 0, sizeof(Cell));
+    strcpy(s->cells[cell].name, name);
+    s->cells[cell].value = NAN;
+    sheet_index(s, cell);
+    return cell;
+}
+
+static void add_user(Cell *c, int user) {
+    if (c->nusers == c->users_cap) {
+        c->users_cap = c->users_cap ? c->users_cap * 2 : 4;
+        c->users = realloc(c->users, c->users_cap * sizeof(int));
+        if (!c->users) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
+        }
+    }
+    c->users[c->nusers++] = user;
+}
+
+static void remove_user(Cell *c, int user) {
+    for (int i = 0; i < c->nusers; i++)
+        if (c->users[i] == user) {
+            c->users[i] = c->users[--c->nusers];
+            return;
+        }
+}
+
+static void cell_eval(const Sheet *s, Cell *c) {
+    double regs[MAX_REGS];
+
+    if (!c->text) {
+        c->value = NAN;
+        return;
+    }
+    program_load(&c->prog, regs);
+    for (int v = 0; v < c->prog.nvars; v++)
+        regs[v] = s->cells[c->deps[v]].value;
+    c->value = program_run(&c->prog, regs);
+}
+
+static void *sheet_worker(void *arg) {
+    SheetSlice *slice = arg;
+
+    for (int i = 0; i < slice->count; i++)
+        cell_eval(slice->sheet, &slice->sheet->cells[slice->cells[i]]);
+    return NULL;
+}
+
+static void sheet_eval_level(Sheet *s, const int *cells, int count) {
+    int threads = count >= SHEET_PARALLEL ? s->threads : 1;
+    pthread_t ids[MAX_THREADS];
+    SheetSlice slices[MAX_THREADS];
+
+    for (int t = 0; t < threads; t++) {
+        int from = (long)count * t / threads, to = (long)count * (t + 1) / threads;
+
+        slices[t] = (SheetSlice){ s, cells + from, to - from };
+        if (t && pthread_create(&ids[t], NULL, sheet_worker, &slices[t]) != 0) {
+            sheet_worker(&slices[t]);
+            slices[t].count = -1; // not started
+        }
+    }
+    sheet_worker(&slices[0]);
+    for (int t = 1; t < threads; t++)
+        if (slices[t].count >= 0)
+            pthread_join(ids[t], NULL);
+}
+
+// Function to recompute cell and everything downstream of it. The dirty
+// set is found first, then evaluated level by level: a cell is ready once
+// none of its inputs are still dirty.
+static void sheet_update(Sheet *s, int cell) {
+    double start = now_seconds();
+    unsigned int walk = ++s->walk;
+    int top = 0, nlevel = 0;
+    long updated = 0;
+
+    s->stack[top++] = cell;
+    s->cells[cell].seen = walk;
+    while (top) {
+        Cell *c = &s->cells[s->stack[--top]];
+
+        c->pending = 0;
+        for (int i = 0; i < c->nusers; i++)
+            if (s->cells[c->users[i]].seen != walk) {
+                s->cells[c->users[i]].seen = walk;
+                s->stack[top++] = c->users[i];
+            }
+    }
+
+    // Count each dirty cell's dirty inputs, going over the users lists
+    // again; deps of a dirty cell that aren't dirty don't count
+    s->stack[top++] = cell;
+    s->cells[cell].target = walk;
+    while (top) {
+        Cell *c = &s->cells[s->stack[--top]];
+
+        for (int i = 0; i < c->nusers; i++) {
+            Cell *u = &s->cells[c->users[i]];
+
+            u->pending++;
+            if (u->target != walk) {
+                u->target = walk;
+                s->stack[top++] = c->users[i];
+            }
+        }
+    }
+
+    s->level[nlevel++] = cell;
+    while (nlevel) {
+        int nnext = 0;
+
+        sheet_eval_level(s, s->level, nlevel);
+        updated += nlevel;
+        for (int i = 0; i < nlevel; i++) {
+            Cell *c = &s->cells[s->level[i]];
+
+            for (int k = 0; k < c->nusers; k++)
+                if (--s->cells[c->users[k]].pending == 0)
+                    s->next[nnext++] = c->users[k];
+        }
+
+        int *t = s->level;
+        s->level = s->next;
+        s->next = t;
+        nlevel = nnext;
+    }
+
+    s->last_updated = updated;
+    s->last_update_ms = (now_seconds() - start) * 1e3;
+}
+
+// Function to check whether cell reads, directly or not, any of deps
+// (or is one of them): defining it that way would close a cycle
+static int sheet_cycle(Sheet *s, int cell, const int *deps, int ndeps) {
+    unsigned int walk = ++s->walk;
+    int top = 0;
+
+    for (int i = 0; i < ndeps; i++)
+        s->cells[deps[i]].target = walk;
+    s->stack[top++] = cell;
+    s->cells[cell].seen = walk;
+    while (top) {
+        Cell *c = &s->cells[s->stack[--top]];
+
+        if (c->target == walk)
+            return 1;
+        for (int i = 0; i < c->nusers; i++)
+            if (s->cells[c->users[i]].seen != walk) {
+                s->cells[c->users[i]].seen = walk;
+                s->stack[top++] = c->users[i];
+            }
+    }
+    return 0;
+}
+
+// Function to (re)define a cell from prog, taking ownership of it and text
+static int sheet_define(Sheet *s, const char *name, char *text, Program *prog) {
+    int cell = sheet_cell(s, name);
+    int *deps = xcalloc(prog->nvars, sizeof(int));
+
+    for (int v = 0; v < prog->nvars; v++)
+        deps[v] = sheet_cell(s, prog->vars[v]);
+    if (sheet_cycle(s, cell, deps, prog->nvars)) {
+        printf("Error: %s would depend on itself\n", name);
+        free(deps);
+        free(text);
+        program_free(prog);
+        return -1;
+    }
+
+    Cell *c = &s->cells[cell];
+
+    for (int v = 0; v < c->prog.nvars; v++)
+        remove_user(&s->cells[c->deps[v]], cell);
+    for (int v = 0; v < prog->nvars; v++)
+        add_user(&s->cells[deps[v]], cell);
+    program_free(&c->prog);
+    free(c->deps);
+    free(c->text);
+    c->prog = *prog;
+    c->deps = deps;
+    c->text = text;
+    sheet_update(s, cell);
+    return cell;
+}
+
+static void sheet_free(Sheet *s) {
+    for (int i = 0; i < s->ncells; i++) {
+        program_free(&s->cells[i].prog);
+        free(s->cells[i].deps);
+        free(s->cells[i].users);
+        free(s->cells[i].text);
+    }
+    free(s->cells);
+    free(s->table);
+    free(s->stack);
+    free(s->level);
+    free(s->next);
+    memset(s, 0, sizeof(*s));
+}
+
+// Function to check that no cell depends on itself anywhere in the sheet,
+// as sheet_cycle() does for one edit: peel off the cells with no inputs
+// left, and any cell that never runs out of them is on a cycle
+static int sheet_acyclic(Sheet *s) {
+    int top = 0, done = 0;
+
+    for (int i = 0; i < s->ncells; i++) {
+        s->cells[i].pending = s->cells[i].prog.nvars;
+        if (!s->cells[i].pending)
+            s->stack[top++] = i;
+    }
+    while (top) {
+        Cell *c = &s->cells[s->stack[--top]];
+
+        done++;
+        for (int i = 0; i < c->nusers; i++)
+            if (--s->cells[c->users[i]].pending == 0)
+                s->stack[top++] = c->users[i];
+    }
+    return done == s->ncells ? 0 : -1;
+}
+
+static void put_bytes(FILE *f, const void *p, size_t n) {
+    if (n)
+        fwrite(p, 1, n, f);
+}
+
+// Function to save every cell: its definition, value and compiled form,
+// so loading needs no parsing or recomputing. Native byte order.
+static int sheet_save(const Sheet *s, const char *path) {
+    FILE *f = fopen(path, "wb");
+
+    if (!f)
+        return -1;
+    put_bytes(f, SHEET_MAGIC, 8);
+    put_bytes(f, &s->ncells, sizeof(int));
+    for (int i = 0; i < s->ncells; i++) {
+        const Cell *c = &s->cells[i];
+        const Program *p = &c->prog;
+        uint8_t name_len = strlen(c->name);
+        uint32_t text_len = c->text ? strlen(c->text) + 1 : 0; // 0: undefined
+
+        put_bytes(f, &name_len, 1);
+        put_bytes(f, c->name, name_len);
+        put_bytes(f, &text_len, 4);
+        put_bytes(f, c->text, text_len ? text_len - 1 : 0);
+        put_bytes(f, &c->value, sizeof(double));
+        if (!text_len)
+            continue;
+
+        int header[5] = { p->len, p->nconsts, p->nvars, p->nregs, p->result };
+
+        put_bytes(f, header, sizeof(header));
+        // Field by field: an Instr's padding byte is never written
+        for (int k = 0; k < p->len; k++) {
+            const Instr *in = &p->code[k];
+
+            put_bytes(f, &in->op, 1);
+            put_bytes(f, &in->dst, 2);
+            put_bytes(f, &in->a, 2);
+            put_bytes(f, &in->b, 2);
+        }
+        put_bytes(f, p->consts, p->nconsts * sizeof(double));
+        put_bytes(f, c->deps, p->nvars * sizeof(int));
+    }
+    int failed = ferror(f);
+
+    return fclose(f) == 0 && !failed ? 0 : -1;
+}
+
+typedef struct {
+    const char *pos, *end;
+} Reader;
+
+static int get_bytes(Reader *r, void *p, size_t n) {
+    if ((size_t)(r->end - r->pos) < n)
+        return -1;
+    memcpy(p, r->pos, n);
+    r->pos += n;
+    return 0;
+}
+
+static void *get_array(Reader *r, size_t n, size_t size) {
+    void *p;
+
+    if (n > (size_t)(r->end - r->pos) / size)
+        return NULL;
+    p = xcalloc(n, size);
+    get_bytes(r, p, n * size);
+    return p;
+}
+
+// Function to replace s with the sheet saved in path
+static int sheet_load(Sheet *s, const char *path, const char **error) {
+    size_t size;
+    char *data = read_all(path, &size);
+    Reader r = { data, data + size };
+    Sheet loaded = { .threads = s->threads };
+    char magic[8];
+    int ncells;
+
+    *error = "Not a gcalc sheet";
+    if (!data) {
+        *error = strerror(errno);
+        return -1;
+    }
+    if (get_bytes(&r, magic, 8) < 0 || memcmp(magic, SHEET_MAGIC, 8) ||
+        get_bytes(&r, &ncells, sizeof(int)) < 0 || ncells < 0)
+        goto bad;
+    if (ncells > (r.end - r.pos) / 13) // the smallest a cell can be saved in
+        goto bad;
+    sheet_reserve(&loaded, ncells);
+
+    // Cells first, so deps can be checked against the count
+    for (int i = 0; i < ncells; i++) {
+        char name[MAX_NAME];
+        uint8_t name_len;
+        uint32_t text_len;
+        Cell *c;
+
+        if (get_bytes(&r, &name_len, 1) < 0 || name_len >= MAX_NAME ||
+            get_bytes(&r, name, name_len) < 0)
+            goto bad;
+        name[name_len] = '\0';
+        if (sheet_cell(&loaded, name) != i) // a name saved twice
+            goto bad;
+        c = &loaded.cells[i];
+        if (get_bytes(&r, &text_len, 4) < 0 || (size_t)(r.end - r.pos) < text_len)
+            goto bad;
+        if (text_len) {
+            c->text = xcalloc(text_len, 1);
+            get_bytes(&r, c->text, text_len - 1);
+        }
+        if (get_bytes(&r, &c->value, sizeof(double)) < 0)
+            goto bad;
+        if (!text_len)
+            continue;
+
+        Program *p = &c->prog;
+        int header[5];
+
+        if (get_bytes(&r, header, sizeof(header)) < 0)
+            goto bad;
+        p->len = header[0];
+        p->nconsts = header[1];
+        p->nvars = header[2];
+        p->nregs = header[3];
+        p->result = header[4];
+        if (p->len < 0 || p->nconsts < 0 || p->nvars < 0 || p->nregs > MAX_REGS ||
+            p->nvars + p->nconsts > p->nregs || p->result < 0 || p->result >= p->nregs)
+            goto bad;
+        if ((size_t)p->len > (size_t)(r.end - r.pos) / INSTR_BYTES)
+            goto bad;
+        p->code = xcalloc(p->len, sizeof(Instr));
+        for (int k = 0; k < p->len; k++) {
+            Instr *in = &p->code[k];
+
+            get_bytes(&r, &in->op, 1);
+            get_bytes(&r, &in->dst, 2);
+            get_bytes(&r, &in->a, 2);
+            get_bytes(&r, &in->b, 2);
+            if (in->dst >= p->nregs || in->a >= p->nregs || in->b >= p->nregs)
+                goto bad;
+        }
+        p->consts = get_array(&r, p->nconsts, sizeof(double));
+        c->deps = get_array(&r, p->nvars, sizeof(int));
+        if (!p->consts || !c->deps)
+            goto bad;
+    }
+    if (r.pos != r.end)
+        goto bad;
+
+    // Then the graph: names for the variables, and users from deps
+    for (int i = 0; i < ncells; i++) {
+        Cell *c = &loaded.cells[i];
+
+        c->prog.vars = xcalloc(c->prog.nvars, MAX_NAME);
+        for (int v = 0; v < c->prog.nvars; v++) {
+            if (c->deps[v] < 0 || c->deps[v] >= ncells)
+                goto bad;
+            strcpy(c->prog.vars[v], loaded.cells[c->deps[v]].name);
+            add_user(&loaded.cells[c->deps[v]], i);
+        }
+    }
+    if (sheet_acyclic(&loaded) < 0)
+        goto bad;
+
+    free(data);
+    sheet_free(s);
+    *s = loaded;
+    return 0;
+
+bad:
+    free(data);
+    sheet_free(&loaded);
+    return -1;
+}
+
+static void print_cell(const Cell *c) {
+    char number[40];
+
+    format_number(c->value, number);
+    if (c->text)
+        printf("%s = %s  (%s)\n", c->name, number, c->text);
+    else
+        printf("%s is undefined\n", c->name);
+}
+
+static int is_name(const char *text, size_t len) {
+    if (!len || len >= MAX_NAME || (!isalpha((unsigned char)*text) && *text != '_'))
+        return 0;
+    for (size_t i = 1; i < len; i++)
+        if (!isalnum((unsigned char)text[i]) && text[i] != '_')
+            return 0;
+    return 1;
+}
+
+static void sheet_command(Sheet *s, char *line, int interactive) {
+    char *eq = strchr(line, '=');
+    const char *error;
+    int error_at;
+    Program prog;
+
+    line += strspn(line, " \t");
+    if (!*line || *line == '#')
+        return;
+
+    if (*line == ':') {
+        char *arg = line + strcspn(line, " \t");
+
+        if (*arg)
+            *arg++ = '\0';
+        arg += strspn(arg, " \t");
+        if (!strcmp(line, ":save") && *arg) {
+            if (sheet_save(s, arg) < 0)
+                printf("Error: %s: %s\n", arg, strerror(errno));
+        } else if (!strcmp(line, ":load") && *arg) {
+            double start = now_seconds();
+
+            if (sheet_load(s, arg, &error) < 0)
+                printf("Error: %s: %s\n", arg, error);
+            else
+                printf("%d cells loaded in %.1f ms\n", s->ncells, (now_seconds() - start) * 1e3);
+        } else if (!strcmp(line, ":list")) {
+            for (int i = 0; i < s->ncells; i++)
+                print_cell(&s->cells[i]);
+        } else if (!strcmp(line, ":stats")) {
+            printf("%d cells; last change recomputed %ld in %.3f ms\n",
+                   s->ncells, s->last_updated, s->last_update_ms);
+        } else {
+            printf("Commands: NAME = EXPR, EXPR, :list, :stats, :save FILE, :load FILE, :quit\n");
+        }
+        return;
+    }
+
+    // Definition: NAME = EXPR
+    if (eq) {
+        char *name = line, *end = eq;
+
+        while (end > name && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (!is_name(name, end - name)) {
+            printf("Error: Expected NAME = EXPR\n");
+            return;
+        }
+        *end = '\0';
+        if (!strcmp(name, "pi") || !strcmp(name, "e")) {
+            printf("Error: %s is a constant\n", name);
+            return;
+        }
+
+        char *text = eq + 1 + strspn(eq + 1, " \t");
+
+        if (program_compile(&prog, text, &error, &error_at) < 0) {
+            print_error(text, error, error_at);
+            return;
+        }
+
+        int cell = sheet_define(s, name, strdup(text), &prog);
+
+        if (cell >= 0 && interactive) {
+            print_cell(&s->cells[cell]);
+            if (s->last_updated > 1)
+                printf("  %ld cells recomputed in %.3f ms\n", s->last_updated, s->last_update_ms);
+        }
+        return;
+    }
+
+    // Query: any expression over the cells
+    if (program_compile(&prog, line, &error, &error_at) < 0) {
+        print_error(line, error, error_at);
+        return;
+    }
+
+    double regs[MAX_REGS];
+    char number[40];
+
+    program_load(&prog, regs);
+    for (int v = 0; v < prog.nvars; v++) {
+        int cell = sheet_find(s, prog.vars[v]);
+
+        if (cell < 0 || !s->cells[cell].text) {
+            printf("Error: %s is undefined\n", prog.vars[v]);
+            program_free(&prog);
+            return;
+        }
+        regs[v] = s->cells[cell].value;
+    }
+    format_number(program_run(&prog, regs), number);
+    printf("%s\n", number);
+    program_free(&prog);
+}
+
+static int run_sheet(const char *path) {
+    Sheet sheet = { .threads = sysconf(_SC_NPROCESSORS_ONLN) };
+    int interactive = isatty(0);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    if (sheet.threads < 1 || sheet.threads > MAX_THREADS)
+        sheet.threads = sheet.threads < 1 ? 1 : MAX_THREADS;
+    if (path) {
+        const char *error;
+
+        if (sheet_load(&sheet, path, &error) < 0) {
+            printf("Error: %s: %s\n", path, error);
+            return 1;
+        }
+    }
+
+    for (;;) {
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        if ((len = getline(&line, &cap, stdin)) < 0)
+            break;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!strcmp(line, ":quit") || !strcmp(line, ":q"))
+            break;
+        sheet_command(&sheet, line, interactive);
+    }
+    free(line);
+    sheet_free(&sheet);
+    return 0;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s [EXPR [NAME=VALUE...]]\n", name);
+    printf("       %s --bench RUNS EXPR [NAME=VALUE...]\n", name);
+    printf("       %s --batch [--threads N] [FILE]\n", name);
+    printf("       %s --csv FILE [--sum] [--min] [--max] [--mean] EXPR\n", name);
+    printf("       %s --exact [--digits N] EXPR\n", name);
+    printf("       %s --exact-bench\n", name);
+    printf("       %s --repl [SHEET]\n", name);
+    printf("Without EXPR, prompts for one. --bench times the interpreter against\n");
+    printf("native code compiled by the x86-64 JIT, when the expression allows it.\n");
+    printf("--batch evaluates one expression per line\n");
+    printf("of FILE (or stdin) and prints one result per line.\n");
+    printf("--csv evaluates EXPR for every row of a numeric CSV file. Columns are\n");
+    printf("named col1, col2, ... or by the header line if there is one.\n");
+    printf("Rows go through the JIT instead of the interpreter when that's faster.\n");
+    printf("--exact works in arbitrary precision with + - * / %% ^; division keeps\n");
+    printf("N fraction digits (default 50).\n");
+    printf("--repl reads NAME = EXPR definitions and queries, keeping every cell up\n");
+    printf("to date as its inputs change; :save and :load keep sheets in files.\n");
+    printf("Operators: + - * / %% ^ and parentheses. Constants: pi, e.\n");
+    printf("Functions:");
+    for (int f = 0; f < (int)(sizeof(functions) / sizeof(functions[0])); f++)
+        printf(" %s", functions[f].name);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    char line[4096];
+    const char *text, *error;
+    int error_at, arg = 1;
+    long bench_runs = 0;
+    Program prog;
+    double regs[MAX_REGS];
+    char bound[MAX_REGS] = { 0 };
+
+    if (arg < argc && (!strcmp(argv[arg], "--help") || !strcmp(argv[arg], "-h"))) {
+        usage(argv[0]);
+        return 0;
+    }
+    if (arg < argc && !strcmp(argv[arg], "--batch")) {
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (++arg + 1 < argc && !strcmp(argv[arg], "--threads")) {
+            threads = atol(argv[arg + 1]);
+            arg += 2;
+        }
+        if (threads < 1 || threads > MAX_THREADS || arg + 1 < argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_batch(arg < argc ? argv[arg] : NULL, threads);
+    }
+    if (arg < argc && !strcmp(argv[arg], "--repl")) {
+        if (arg + 2 < argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_sheet(arg + 1 < argc ? argv[arg + 1] : NULL);
+    }
+    if (arg < argc && !strcmp(argv[arg], "--exact-bench")) {
+        exact_bench();
+        return 0;
+    }
+    if (arg + 1 < argc && !strcmp(argv[arg], "--exact")) {
+        long digits = 50;
+
+        if (++arg + 2 < argc && !strcmp(argv[arg], "--digits")) {
+            digits = atol(argv[arg + 1]);
+            arg += 2;
+        }
+        if (digits < 0 || arg + 1 != argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_exact(argv[arg], digits);
+    }
+    if (arg + 1 < argc && !strcmp(argv[arg], "--csv")) {
+        const char *path = argv[arg + 1];
+        int aggregates = 0;
+
+        for (arg += 2; arg < argc && !strncmp(argv[arg], "--", 2); arg++) {
+            if (!strcmp(argv[arg], "--sum"))
+                aggregates |= AGG_SUM;
+            else if (!strcmp(argv[arg], "--min"))
+                aggregates |= AGG_MIN;
+            else if (!strcmp(argv[arg], "--max"))
+                aggregates |= AGG_MAX;
+            else if (!strcmp(argv[arg], "--mean"))
+                aggregates |= AGG_MEAN;
+            else
+                break;
+        }
+        if (arg + 1 != argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_columns(path, argv[arg], aggregates);
+    }
+    if (arg + 1 < argc && !strcmp(argv[arg], "--bench")) {
+        bench_runs = atol(argv[arg + 1]);
+        arg += 2;
+        if (bench_runs <= 0 || arg >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (arg < argc) {
+        text = argv[arg++];
+    } else {
+        printf("Enter calculation (e.g., 3.5 + 4.2): ");
+        if (!fgets(line, sizeof(line), stdin)) {
+            printf("Invalid input\n");
+            return 1;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        text = line;
+    }
+
+    if (program_compile(&prog, text, &error, &error_at) < 0) {
+        print_error(text, error, error_at);
+        return 1;
+    }
+    program_load(&prog, regs);
+
+    // Bindings
+    for (; arg < argc; arg++) {
+        const char *eq = strchr(argv[arg], '=');
+        char name[MAX_NAME];
+        char *end;
+        int v;
+
+        if (!eq || eq == argv[arg] || eq - argv[arg] >= MAX_NAME) {
+            printf("Error: Expected NAME=VALUE, got '%s'\n", argv[arg]);
+            return 1;
+        }
+        memcpy(name, argv[arg], eq - argv[arg]);
+        name[eq - argv[arg]] = '\0';
+        v = program_var(&prog, name);
+        if (v < 0)
+            continue; // not used by this expression
+        regs[v] = strtod(eq + 1, &end);
+        bound[v] = 1;
+        if (end == eq + 1 || *end) {
+            printf("Error: Invalid value for %s\n", name);
+            return 1;
+        }
+    }
+    for (int v = 0; v < prog.nvars; v++)
+        if (!bound[v]) {
+            printf("Error: No value for %s\n", prog.vars[v]);
+            return 1;
+        }
+
+    if (bench_runs) {
+        bench(&prog, regs, bench_runs);
+    } else {
+        double result;
+
+        if (program_run_checked(&prog, regs, &result) < 0) {
+            printf("Error: Division by zero\n");
+            return 1;
+        }
+        printf("Result: %.2f\n", result);
     }
 
+    program_free(&prog);
     return 0;
 }
@@ -11,6 +11,21 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "ggb.h"
 
 // Flag bit masks
 #define FLAG_Z  0x80 // Zero flag
@@ -58,14 +73,83 @@ typedef struct {
     uint16_t sp; // stack pointer
     uint16_t pc; // program counter
     bool halted;
+    bool stopped; // STOP executed; nothing short of a reset resumes it
     bool ime; // Interrupt Master Enable flag
 } CPU;
 
-uint8_t memory[0x10000];
+#define SCREEN_WIDTH GGB_SCREEN_WIDTH
+#define SCREEN_HEIGHT GGB_SCREEN_HEIGHT
+#define TILE_SIZE 8
+
+typedef struct {
+    int mode;         // 0–3
+    int mode_clock;   // cycles in current mode
+    int line;         // current scanline (0–153)
+} PPU;
+
+typedef struct {
+    int fd;             // link socket, -1 with no cable plugged in
+    bool active;        // a transfer is in flight, on either clock
+    uint64_t done_at;   // cycle the in-flight transfer finishes at
+    bool have_reply;
+    uint8_t reply;      // byte shifted in from the peer
+    bool have_pending;  // peer transfer waiting for our clock to catch up
+    uint64_t pending_at;
+    uint8_t pending_data;
+    uint64_t next_poll;
+    char *log;          // if set, bytes we send as master are appended here
+    size_t log_len;
+    size_t log_size;
+} Serial;
+
+// One emulated machine. Everything a running game can change lives in
+// here; the cartridge ROM is only referenced, so any number of machines
+// can share a single read-only copy of it.
+typedef struct {
+    CPU cpu;
+    PPU ppu;
+    Serial serial;
+    uint64_t cycle_count;   // cycles run since power on
+    bool frame_done;        // PPU entered V-Blank
+    bool trace;             // print every instruction executed
+    bool breakpoint;        // LD B, B executed (debug breakpoint)
+    int bad_opcode;         // first unimplemented opcode hit, or -1
+    uint8_t joypad;         // buttons held, GGB_BTN_* bits
+    const uint8_t *rom;     // 0x0000-0x7FFF
+    uint8_t (*framebuffer)[SCREEN_WIDTH];
+    uint8_t ram[0x8000];    // 0x8000-0xFFFF: VRAM, cart RAM, WRAM, OAM, IO, HRAM
+} GB;
+
+// Direct access to anything from 0x8000 up, bypassing IO side effects
+#define RAM(gb, addr) ((gb)->ram[(uint16_t)(addr) - 0x8000])
 
 // Special IO registers for interrupts
-uint8_t *REG_IF = &memory[0xFF0F]; // Interrupt Flag
-uint8_t *REG_IE = &memory[0xFFFF]; // Interrupt Enable
+#define REG_IF(gb) RAM(gb, 0xFF0F) // Interrupt Flag
+#define REG_IE(gb) RAM(gb, 0xFFFF) // Interrupt Enable
+
+#define REG_P1 0xFF00 // Joypad
+
+#define TRACE(gb, ...) do { if ((gb)->trace) printf(__VA_ARGS__); } while (0)
+
+// Joypad lines are active low; bits 4/5 select the d-pad or the buttons
+static inline uint8_t joypad_read(GB *gb) {
+    uint8_t p1 = RAM(gb, REG_P1) | 0xCF;
+
+    if (!(p1 & 0x10)) p1 &= ~(gb->joypad & 0x0F);
+    if (!(p1 & 0x20)) p1 &= ~(gb->joypad >> 4);
+    return p1;
+}
+
+static inline uint8_t mem_read(GB *gb, uint16_t addr) {
+    if (addr < 0x8000) return gb->rom[addr];
+    if (addr == REG_P1) return joypad_read(gb);
+    return RAM(gb, addr);
+}
+
+static inline void mem_write(GB *gb, uint16_t addr, uint8_t val) {
+    if (addr < 0x8000) return; // no MBC yet, so ROM writes go nowhere
+    RAM(gb, addr) = val;
+}
 
 static inline void set_flag(CPU *cpu, uint8_t flag, bool condition) {
     if (condition) cpu->f |= flag;
@@ -74,42 +158,50 @@ static inline void set_flag(CPU *cpu, uint8_t flag, bool condition) {
 
 // Opcodes
 
-void opcode_NOP(CPU *cpu) {
-    printf("NOP executed at PC=0x%04X\n", cpu->pc - 1);
+void opcode_NOP(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    TRACE(gb, "NOP executed at PC=0x%04X\n", cpu->pc - 1);
 }
 
-void opcode_HALT(CPU *cpu) {
+void opcode_HALT(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->halted = true;
-    printf("HALT executed at PC=0x%04X\n", cpu->pc - 1);
+    TRACE(gb, "HALT executed at PC=0x%04X\n", cpu->pc - 1);
 }
 
-void opcode_STOP(CPU *cpu) {
-    uint8_t next_byte = memory[cpu->pc++]; // fetch and ignore
+void opcode_STOP(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t next_byte = mem_read(gb, cpu->pc++); // fetch and ignore
     (void)next_byte;
 
-    printf("STOP executed at PC=0x%04X\n", cpu->pc - 2);
+    TRACE(gb, "STOP executed at PC=0x%04X\n", cpu->pc - 2);
     cpu->halted = true;  // treat like HALT for now
+    cpu->stopped = true;
 }
 
-void opcode_LD_B_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_B_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->b = val;
-    printf("LD B, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD B, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_LD_A_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_A_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->a = val;
-    printf("LD A, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD A, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_LD_C_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_C_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->c = val;
-    printf("LD C, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD C, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_ADD_A_B(CPU *cpu) {
+void opcode_ADD_A_B(GB *gb) {
+    CPU *cpu = &gb->cpu;
     uint8_t a = cpu->a;
     uint8_t b = cpu->b;
     uint16_t result = a + b;
@@ -121,10 +213,11 @@ void opcode_ADD_A_B(CPU *cpu) {
     set_flag(cpu, FLAG_H, ((a & 0xF) + (b & 0xF)) > 0xF);
     set_flag(cpu, FLAG_C, result > 0xFF);
 
-    printf("ADD A, B executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "ADD A, B executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
-void opcode_ADD_A_C(CPU *cpu) {
+void opcode_ADD_A_C(GB *gb) {
+    CPU *cpu = &gb->cpu;
     uint8_t a = cpu->a;
     uint8_t c = cpu->c;
     uint16_t result = a + c;
@@ -136,205 +229,239 @@ void opcode_ADD_A_C(CPU *cpu) {
     set_flag(cpu, FLAG_H, ((a & 0xF) + (c & 0xF)) > 0xF);
     set_flag(cpu, FLAG_C, result > 0xFF);
 
-    printf("ADD A, C executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "ADD A, C executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
-void opcode_LD_D_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_D_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->d = val;
-    printf("LD D, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD D, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_LD_E_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_E_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->e = val;
-    printf("LD E, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD E, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_LD_H_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_H_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->h = val;
-    printf("LD H, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD H, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_LD_L_n(CPU *cpu) {
-    uint8_t val = memory[cpu->pc++];
+void opcode_LD_L_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t val = mem_read(gb, cpu->pc++);
     cpu->l = val;
-    printf("LD L, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
+    TRACE(gb, "LD L, 0x%02X executed at PC=0x%04X\n", val, cpu->pc - 2);
 }
 
-void opcode_INC_B(CPU *cpu) {
+void opcode_INC_B(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->b++;
     set_flag(cpu, FLAG_Z, cpu->b == 0);
     set_flag(cpu, FLAG_N, false);
     set_flag(cpu, FLAG_H, (cpu->b & 0x0F) == 0x00);
-    printf("INC B executed: B=0x%02X at PC=0x%04X\n", cpu->b, cpu->pc - 1);
+    TRACE(gb, "INC B executed: B=0x%02X at PC=0x%04X\n", cpu->b, cpu->pc - 1);
 }
 
-void opcode_DEC_B(CPU *cpu) {
+void opcode_DEC_B(GB *gb) {
+    CPU *cpu = &gb->cpu;
     set_flag(cpu, FLAG_H, (cpu->b & 0x0F) == 0x00);
     cpu->b--;
     set_flag(cpu, FLAG_Z, cpu->b == 0);
     set_flag(cpu, FLAG_N, true);
-    printf("DEC B executed: B=0x%02X at PC=0x%04X\n", cpu->b, cpu->pc - 1);
+    TRACE(gb, "DEC B executed: B=0x%02X at PC=0x%04X\n", cpu->b, cpu->pc - 1);
 }
 
-void opcode_AND_A_B(CPU *cpu) {
+void opcode_AND_A_B(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a &= cpu->b;
     set_flag(cpu, FLAG_Z, cpu->a == 0);
     set_flag(cpu, FLAG_N, false);
     set_flag(cpu, FLAG_H, true);
     set_flag(cpu, FLAG_C, false);
-    printf("AND A, B executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "AND A, B executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
-void opcode_XOR_A_A(CPU *cpu) {
+void opcode_XOR_A_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a ^= cpu->a;
     set_flag(cpu, FLAG_Z, cpu->a == 0);
     set_flag(cpu, FLAG_N, false);
     set_flag(cpu, FLAG_H, false);
     set_flag(cpu, FLAG_C, false);
-    printf("XOR A, A executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "XOR A, A executed: A=0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
-void opcode_JP_nn(CPU *cpu) {
-    uint16_t addr = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_JP_nn(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t addr = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->pc = addr;
-    printf("JP to 0x%04X\n", addr);
+    TRACE(gb, "JP to 0x%04X\n", addr);
 }
 
-void opcode_CALL_nn(CPU *cpu) {
-    uint16_t addr = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_CALL_nn(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t addr = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->pc += 2;
-    push_stack(cpu, cpu->pc);
+    push_stack(gb, cpu->pc);
     cpu->pc = addr;
-    printf("CALL to 0x%04X\n", addr);
+    TRACE(gb, "CALL to 0x%04X\n", addr);
 }
 
-void opcode_RET(CPU *cpu) {
-    uint16_t lo = memory[cpu->sp++];
-    uint16_t hi = memory[cpu->sp++];
+void opcode_RET(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t lo = mem_read(gb, cpu->sp++);
+    uint16_t hi = mem_read(gb, cpu->sp++);
     cpu->pc = lo | (hi << 8);
-    printf("RET to 0x%04X\n", cpu->pc);
+    TRACE(gb, "RET to 0x%04X\n", cpu->pc);
 }
 
-void opcode_LD_HL_A(CPU *cpu) {
-    memory[cpu->hl] = cpu->a;
-    printf("LD (HL), A executed: HL=0x%04X <- A=0x%02X at PC=0x%04X\n", cpu->hl, cpu->a, cpu->pc - 1);
+void opcode_LD_HL_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    mem_write(gb, cpu->hl, cpu->a);
+    TRACE(gb, "LD (HL), A executed: HL=0x%04X <- A=0x%02X at PC=0x%04X\n", cpu->hl, cpu->a, cpu->pc - 1);
 }
 
-void opcode_LD_A_HL(CPU *cpu) {
-    cpu->a = memory[cpu->hl];
-    printf("LD A, (HL) executed: A <- (0x%04X)=0x%02X at PC=0x%04X\n", cpu->hl, cpu->a, cpu->pc - 1);
+void opcode_LD_A_HL(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    cpu->a = mem_read(gb, cpu->hl);
+    TRACE(gb, "LD A, (HL) executed: A <- (0x%04X)=0x%02X at PC=0x%04X\n", cpu->hl, cpu->a, cpu->pc - 1);
 }
 
-void opcode_LD_a16_A(CPU *cpu) {
-    uint16_t addr = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_LD_a16_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t addr = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->pc += 2;
-    memory[addr] = cpu->a;
-    printf("LD (0x%04X), A executed: A=0x%02X at PC=0x%04X\n", addr, cpu->a, cpu->pc - 3);
+    mem_write(gb, addr, cpu->a);
+    TRACE(gb, "LD (0x%04X), A executed: A=0x%02X at PC=0x%04X\n", addr, cpu->a, cpu->pc - 3);
 }
 
-void opcode_LD_A_a16(CPU *cpu) {
-    uint16_t addr = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_LD_A_a16(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t addr = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->pc += 2;
-    cpu->a = memory[addr];
-    printf("LD A, (0x%04X) executed: A=0x%02X at PC=0x%04X\n", addr, cpu->a, cpu->pc - 3);
+    cpu->a = mem_read(gb, addr);
+    TRACE(gb, "LD A, (0x%04X) executed: A=0x%02X at PC=0x%04X\n", addr, cpu->a, cpu->pc - 3);
 }
 
-void opcode_LD_C_A(CPU *cpu) {
-    memory[0xFF00 + cpu->c] = cpu->a;
-    printf("LD (0xFF00+C), A executed: [0x%04X] = 0x%02X at PC=0x%04X\n", 0xFF00 + cpu->c, cpu->a, cpu->pc - 1);
+void opcode_LD_C_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    mem_write(gb, 0xFF00 + cpu->c, cpu->a);
+    TRACE(gb, "LD (0xFF00+C), A executed: [0x%04X] = 0x%02X at PC=0x%04X\n", 0xFF00 + cpu->c, cpu->a, cpu->pc - 1);
 }
 
-void opcode_LD_A_C(CPU *cpu) {
-    cpu->a = memory[0xFF00 + cpu->c];
-    printf("LD A, (0xFF00+C) executed: A = [0x%04X] = 0x%02X at PC=0x%04X\n", 0xFF00 + cpu->c, cpu->a, cpu->pc - 1);
+void opcode_LD_A_C(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    cpu->a = mem_read(gb, 0xFF00 + cpu->c);
+    TRACE(gb, "LD A, (0xFF00+C) executed: A = [0x%04X] = 0x%02X at PC=0x%04X\n", 0xFF00 + cpu->c, cpu->a, cpu->pc - 1);
 }
 
-void opcode_LD_FF00_n_A(CPU *cpu) {
-    uint8_t offset = memory[cpu->pc++];
-    memory[0xFF00 + offset] = cpu->a;
-    printf("LD (0xFF00+0x%02X), A executed: [0x%04X] = 0x%02X at PC=0x%04X\n", offset, 0xFF00 + offset, cpu->a, cpu->pc - 2);
+void opcode_LD_FF00_n_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t offset = mem_read(gb, cpu->pc++);
+    mem_write(gb, 0xFF00 + offset, cpu->a);
+    TRACE(gb, "LD (0xFF00+0x%02X), A executed: [0x%04X] = 0x%02X at PC=0x%04X\n", offset, 0xFF00 + offset, cpu->a, cpu->pc - 2);
 }
 
-void opcode_LD_A_FF00_n(CPU *cpu) {
-    uint8_t offset = memory[cpu->pc++];
-    cpu->a = memory[0xFF00 + offset];
-    printf("LD A, (0xFF00+0x%02X) executed: A = 0x%02X at PC=0x%04X\n", offset, cpu->a, cpu->pc - 2);
+void opcode_LD_A_FF00_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t offset = mem_read(gb, cpu->pc++);
+    cpu->a = mem_read(gb, 0xFF00 + offset);
+    TRACE(gb, "LD A, (0xFF00+0x%02X) executed: A = 0x%02X at PC=0x%04X\n", offset, cpu->a, cpu->pc - 2);
 }
 
 // 0x01 - LD BC, nn
-void opcode_LD_BC_nn(CPU *cpu) {
-    uint16_t nn = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_LD_BC_nn(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t nn = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->bc = nn;
     cpu->pc += 2;
-    printf("LD BC, 0x%04X executed: BC = 0x%04X at PC=0x%04X\n", nn, cpu->bc, cpu->pc - 2);
+    TRACE(gb, "LD BC, 0x%04X executed: BC = 0x%04X at PC=0x%04X\n", nn, cpu->bc, cpu->pc - 2);
 }
 
 // 0x09 - ADD HL, BC
-void opcode_ADD_HL_BC(CPU *cpu) {
+void opcode_ADD_HL_BC(GB *gb) {
+    CPU *cpu = &gb->cpu;
     uint16_t result = cpu->hl + cpu->bc;
     cpu->f = (cpu->hl & 0x8000) != (result & 0x8000);  // Set the carry flag if there's overflow
     cpu->hl = result;
-    printf("ADD HL, BC executed: HL = 0x%04X at PC=0x%04X\n", cpu->hl, cpu->pc - 1);
+    TRACE(gb, "ADD HL, BC executed: HL = 0x%04X at PC=0x%04X\n", cpu->hl, cpu->pc - 1);
 }
 
 // 0x21 - LD HL, nn
-void opcode_LD_HL_nn(CPU *cpu) {
-    uint16_t nn = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_LD_HL_nn(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t nn = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->hl = nn;
     cpu->pc += 2;
-    printf("LD HL, 0x%04X executed: HL = 0x%04X at PC=0x%04X\n", nn, cpu->hl, cpu->pc - 2);
+    TRACE(gb, "LD HL, 0x%04X executed: HL = 0x%04X at PC=0x%04X\n", nn, cpu->hl, cpu->pc - 2);
 }
 
 // 0x31 - LD SP, nn
-void opcode_LD_SP_nn(CPU *cpu) {
-    uint16_t nn = memory[cpu->pc] | (memory[cpu->pc + 1] << 8);
+void opcode_LD_SP_nn(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint16_t nn = mem_read(gb, cpu->pc) | (mem_read(gb, cpu->pc + 1) << 8);
     cpu->sp = nn;
     cpu->pc += 2;
-    printf("LD SP, 0x%04X executed: SP = 0x%04X at PC=0x%04X\n", nn, cpu->sp, cpu->pc - 2);
+    TRACE(gb, "LD SP, 0x%04X executed: SP = 0x%04X at PC=0x%04X\n", nn, cpu->sp, cpu->pc - 2);
 }
 
 // 0x3C - INC A
-void opcode_INC_A(CPU *cpu) {
+void opcode_INC_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a++;
     cpu->f = (cpu->a == 0) ? FLAG_Z : 0;  // Set Zero flag if A is 0
-    printf("INC A executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "INC A executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
 // 0x2F - CPL (Complement A)
-void opcode_CPL(CPU *cpu) {
+void opcode_CPL(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a = ~cpu->a;
     cpu->f = FLAG_N | FLAG_H;  // Set Subtract and Half Carry flags
-    printf("CPL executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "CPL executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
 // 0xE6 - AND n
-void opcode_AND_n(CPU *cpu) {
-    uint8_t n = memory[cpu->pc++];
+void opcode_AND_n(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t n = mem_read(gb, cpu->pc++);
     cpu->a &= n;
     cpu->f = (cpu->a == 0) ? FLAG_Z : 0;  // Set Zero flag if A is 0
     cpu->f |= FLAG_H;  // Set Half Carry flag (since AND is a logical operation)
-    printf("AND 0x%02X executed: A = 0x%02X at PC=0x%04X\n", n, cpu->a, cpu->pc - 1);
+    TRACE(gb, "AND 0x%02X executed: A = 0x%02X at PC=0x%04X\n", n, cpu->a, cpu->pc - 1);
 }
 
 // 0xA7 - AND A
-void opcode_AND_A(CPU *cpu) {
+void opcode_AND_A(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a &= cpu->a;  // ANDing A with itself will just clear the non-zero bits
     cpu->f = (cpu->a == 0) ? FLAG_Z : 0;  // Set Zero flag if A is 0
     cpu->f |= FLAG_H;  // Set Half Carry flag (since AND is a logical operation)
-    printf("AND A executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "AND A executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
 }
 
 // 0xA1 - XOR A, C
-void opcode_XOR_A_C(CPU *cpu) {
+void opcode_XOR_A_C(GB *gb) {
+    CPU *cpu = &gb->cpu;
     cpu->a ^= cpu->c;
     cpu->f = (cpu->a == 0) ? FLAG_Z : 0;
-    printf("XOR A, C executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+    TRACE(gb, "XOR A, C executed: A = 0x%02X at PC=0x%04X\n", cpu->a, cpu->pc - 1);
+}
+
+// 0x40 - LD B, B (a no-op test ROMs use as a debug breakpoint)
+void opcode_LD_B_B(GB *gb) {
+    gb->breakpoint = true;
+    TRACE(gb, "LD B, B executed at PC=0x%04X\n", gb->cpu.pc - 1);
 }
 
-typedef void (*OpcodeFunc)(CPU *);
+typedef void (*OpcodeFunc)(GB *);
 
 OpcodeFunc opcode_table[256] = {
     [0x00] = opcode_NOP,
@@ -382,59 +509,76 @@ OpcodeFunc opcode_table[256] = {
     [0xE6] = opcode_AND_n,
     [0xA7] = opcode_AND_A,
     [0xA1] = opcode_XOR_A_C,
+    [0x40] = opcode_LD_B_B,
+};
+
+// Machine cycles (T-states) taken by each implemented opcode
+const uint8_t opcode_cycles[256] = {
+    [0x00] = 4,  [0x01] = 12, [0x06] = 8,  [0x09] = 8,
+    [0x0E] = 8,  [0x16] = 8,  [0x1E] = 8,  [0x26] = 8,
+    [0x2E] = 8,  [0x04] = 4,  [0x05] = 4,  [0x3E] = 8,
+    [0x10] = 4,  [0x76] = 4,  [0x80] = 4,  [0x81] = 4,
+    [0xA0] = 4,  [0xAF] = 4,  [0xC3] = 16, [0xCD] = 24,
+    [0xC9] = 16, [0x77] = 8,  [0x7E] = 8,  [0xEA] = 16,
+    [0xFA] = 16, [0xE2] = 8,  [0xF2] = 8,  [0xE0] = 12,
+    [0xF0] = 12, [0x21] = 12, [0x31] = 12, [0x3C] = 4,
+    [0x2F] = 4,  [0xE6] = 8,  [0xA7] = 4,  [0xA1] = 4,
+    [0x40] = 4,
 };
 
 // Push PC to stack helper (little endian)
-void push_stack(CPU *cpu, uint16_t val) {
+void push_stack(GB *gb, uint16_t val) {
+    CPU *cpu = &gb->cpu;
     cpu->sp--;
-    memory[cpu->sp] = val & 0xFF;       // low byte
+    mem_write(gb, cpu->sp, val & 0xFF);        // low byte
     cpu->sp--;
-    memory[cpu->sp] = (val >> 8) & 0xFF; // high byte
+    mem_write(gb, cpu->sp, (val >> 8) & 0xFF); // high byte
 }
 
-// Simple interrupt handler (only VBLANK for demo)
-void handle_interrupts(CPU *cpu) {
-    if (!cpu->ime) return; // interrupts disabled
+// Interrupt vectors, in priority order (lowest IF bit first)
+static const struct {
+    uint8_t bit;
+    uint16_t vector;
+    const char *name;
+} interrupts[] = {
+    { INT_VBLANK,  0x40, "VBLANK" },
+    { INT_LCDSTAT, 0x48, "LCDSTAT" },
+    { INT_TIMER,   0x50, "TIMER" },
+    { INT_SERIAL,  0x58, "SERIAL" },
+    { INT_JOYPAD,  0x60, "JOYPAD" },
+};
+
+// Dispatch the highest priority pending interrupt; returns cycles spent
+int handle_interrupts(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    uint8_t fired = REG_IF(gb) & REG_IE(gb) & 0x1F;
+    if (fired == 0) return 0;
 
-    uint8_t fired = (*REG_IF) & (*REG_IE);
-    if (fired == 0) return;
+    cpu->halted = false; // any pending interrupt wakes the CPU, even with IME off
 
-    cpu->halted = false; // wake CPU if halted
+    if (!cpu->ime) return 0; // interrupts disabled
 
-    // Prioritize interrupts low bit first (VBLANK)
-    if (fired & INT_VBLANK) {
-        *REG_IF &= ~INT_VBLANK; // clear IF flag
+    for (unsigned i = 0; i < sizeof(interrupts) / sizeof(interrupts[0]); i++) {
+        if (!(fired & interrupts[i].bit))
+            continue;
+        REG_IF(gb) &= ~interrupts[i].bit; // clear IF flag
         cpu->ime = false; // disable further interrupts
-        push_stack(cpu, cpu->pc);
-        cpu->pc = 0x40; // VBLANK ISR address
-        printf("Interrupt VBLANK handled! Jump to 0x0040\n");
-        return;
+        push_stack(gb, cpu->pc);
+        cpu->pc = interrupts[i].vector;
+        TRACE(gb, "Interrupt %s handled! Jump to 0x%04X\n", interrupts[i].name, interrupts[i].vector);
+        return 20;
     }
-    // Add others later...
+    return 0;
 }
 
-typedef struct {
-    int mode;         // 0–3
-    int mode_clock;   // cycles in current mode
-    int line;         // current scanline (0–153)
-} PPU;
-
-PPU ppu;
-
-void push_framebuffer_to_screen() {
-  return; // Stub
+void push_framebuffer_to_screen(GB *gb) {
+  gb->frame_done = true; // Stub: callers pick the frame up from gb->framebuffer
 }
 
-#define SCREEN_WIDTH 160
-#define SCREEN_HEIGHT 144
-#define TILE_SIZE 8
-
-uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
-
-void draw_scanline(int line) {
+void draw_scanline(GB *gb, int line) {
     // Get scroll values from registers
-    uint8_t scroll_y = memory[0xFF42];
-    uint8_t scroll_x = memory[0xFF43];
+    uint8_t scroll_y = RAM(gb, 0xFF42);
+    uint8_t scroll_x = RAM(gb, 0xFF43);
 
     int y = (scroll_y + line) & 0xFF;      // vertical wrap in BG
     int tile_row = y / TILE_SIZE;
@@ -447,15 +591,15 @@ void draw_scanline(int line) {
         uint16_t bg_map_offset = 0x1800 + tile_row * 32 + tile_col;
 
         // Read tile index from BG Map
-        uint8_t tile_index = memory[0x8000 + bg_map_offset];
+        uint8_t tile_index = RAM(gb, 0x8000 + bg_map_offset);
 
         // Tile data base address at 0x8000, each tile 16 bytes
         uint16_t tile_data_offset = tile_index * 16;
         int line_in_tile = y % TILE_SIZE;
 
         // Read tile line data
-        uint8_t byte1 = memory[0x8000 + tile_data_offset + line_in_tile * 2];
-        uint8_t byte2 = memory[0x8000 + tile_data_offset + line_in_tile * 2 + 1];
+        uint8_t byte1 = RAM(gb, 0x8000 + tile_data_offset + line_in_tile * 2);
+        uint8_t byte2 = RAM(gb, 0x8000 + tile_data_offset + line_in_tile * 2 + 1);
 
         // Calculate bit index for pixel in tile
         int bit = 7 - (x_pos % TILE_SIZE);
@@ -464,7 +608,7 @@ void draw_scanline(int line) {
         int color_num = ((byte2 >> bit) & 1) << 1 | ((byte1 >> bit) & 1);
 
         // Store color number in your framebuffer (or palette index)
-        framebuffer[line][x] = color_num;
+        gb->framebuffer[line][x] = color_num;
     }
 }
 
@@ -473,13 +617,13 @@ void draw_scanline(int line) {
 #define MAX_SPRITES 40
 #define SPRITE_HEIGHT 8  // 8 or 16 depending on LCDC bit
 
-void draw_sprites_on_scanline(int line) {
+void draw_sprites_on_scanline(GB *gb, int line) {
     for (int i = 0; i < MAX_SPRITES; i++) {
         int base = OAM_START + i * SPRITE_ATTRS;
-        int sprite_y = memory[base] - 16;
-        int sprite_x = memory[base + 1] - 8;
-        uint8_t tile_index = memory[base + 2];
-        uint8_t attributes = memory[base + 3];
+        int sprite_y = RAM(gb, base) - 16;
+        int sprite_x = RAM(gb, base + 1) - 8;
+        uint8_t tile_index = RAM(gb, base + 2);
+        uint8_t attributes = RAM(gb, base + 3);
 
         if (line < sprite_y || line >= sprite_y + SPRITE_HEIGHT)
             continue; // sprite not on this scanline
@@ -494,8 +638,8 @@ void draw_sprites_on_scanline(int line) {
         // Tile data offset for this line
         uint16_t tile_data_offset = tile_index * 16 + line_in_sprite * 2;
 
-        uint8_t byte1 = memory[0x8000 + tile_data_offset];
-        uint8_t byte2 = memory[0x8000 + tile_data_offset + 1];
+        uint8_t byte1 = RAM(gb, 0x8000 + tile_data_offset);
+        uint8_t byte2 = RAM(gb, 0x8000 + tile_data_offset + 1);
 
         for (int x = 0; x < 8; x++) {
             int bit = 7 - x;
@@ -510,82 +654,294 @@ void draw_sprites_on_scanline(int line) {
             if (pixel_x < 0 || pixel_x >= SCREEN_WIDTH) continue;
 
             // Choose palette 0 or 1
-            uint8_t palette = (attributes & 0x10) ? memory[0xFF49] : memory[0xFF48];
+            uint8_t palette = (attributes & 0x10) ? RAM(gb, 0xFF49) : RAM(gb, 0xFF48);
 
             // Map color_num through palette (2 bits per color)
             int shade = (palette >> (color_num * 2)) & 0x3;
 
             // TODO: Respect priority and BG color zero rules
 
-            framebuffer[line][pixel_x] = shade;
+            gb->framebuffer[line][pixel_x] = shade;
         }
     }
 }
 
-void ppu_step(int cycles) {
-    ppu.mode_clock += cycles;
+void ppu_step(GB *gb, int cycles) {
+    PPU *ppu = &gb->ppu;
+
+    ppu->mode_clock += cycles;
 
-    switch (ppu.mode) {
+    switch (ppu->mode) {
         case 2: // OAM scan
-            if (ppu.mode_clock >= 80) {
-                ppu.mode_clock -= 80;
-                ppu.mode = 3;
+            if (ppu->mode_clock >= 80) {
+                ppu->mode_clock -= 80;
+                ppu->mode = 3;
             }
             break;
         case 3: // Drawing
-            if (ppu.mode_clock >= 172) {
-                ppu.mode_clock -= 172;
-                ppu.mode = 0;
+            if (ppu->mode_clock >= 172) {
+                ppu->mode_clock -= 172;
+                ppu->mode = 0;
                 // draw the scanline
-                draw_scanline(ppu.line);
-                draw_sprites_on_scanline(ppu.line);
+                draw_scanline(gb, ppu->line);
+                draw_sprites_on_scanline(gb, ppu->line);
             }
             break;
         case 0: // H-Blank
-            if (ppu.mode_clock >= 204) {
-                ppu.mode_clock -= 204;
-                ppu.line++;
-                if (ppu.line == 144) {
-                    ppu.mode = 1; // V-Blank
+            if (ppu->mode_clock >= 204) {
+                ppu->mode_clock -= 204;
+                ppu->line++;
+                if (ppu->line == 144) {
+                    ppu->mode = 1; // V-Blank
                     // trigger V-Blank interrupt
-                    *REG_IF |= INT_VBLANK;
+                    REG_IF(gb) |= INT_VBLANK;
                     // update framebuffer
-                    push_framebuffer_to_screen();
+                    push_framebuffer_to_screen(gb);
                 } else {
-                    ppu.mode = 2;
+                    ppu->mode = 2;
                 }
             }
             break;
         case 1: // V-Blank
-            if (ppu.mode_clock >= 456) {
-                ppu.mode_clock -= 456;
-                ppu.line++;
-                if (ppu.line > 153) {
-                    ppu.mode = 2;
-                    ppu.line = 0;
+            if (ppu->mode_clock >= 456) {
+                ppu->mode_clock -= 456;
+                ppu->line++;
+                if (ppu->line > 153) {
+                    ppu->mode = 2;
+                    ppu->line = 0;
                 }
             }
             break;
     }
 }
 
-void cpu_execute_instruction(CPU *cpu) {
-    handle_interrupts(cpu);
+// Serial link cable
+//
+// Two ggb instances are joined over a UNIX domain socket. Every message is
+// stamped with the sender's cycle count, so neither side has to run in
+// lockstep with the other: the master only blocks once its own 8-bit shift
+// has finished and the peer's byte still hasn't arrived, and the slave
+// applies an incoming byte no earlier than the cycle it was sent at.
+
+#define REG_SB 0xFF01 // Serial transfer data
+#define REG_SC 0xFF02 // Serial transfer control
+
+#define SC_START    0x80
+#define SC_INTERNAL 0x01
+
+#define SERIAL_TRANSFER_CYCLES 4096 // 8 bits at 8192 Hz
+#define LINK_POLL_CYCLES 1024       // how often an idle side checks the socket
+
+enum {
+    LINK_XFER = 1,  // master started a transfer: data = master's SB
+    LINK_REPLY = 2, // slave's answer: data = slave's SB
+};
+
+typedef struct {
+    uint8_t type;
+    uint8_t data;
+    uint8_t pad[6];
+    uint64_t cycle;
+} LinkMessage;
+
+static void link_close(GB *gb) {
+    if (gb->serial.fd >= 0) {
+        close(gb->serial.fd);
+        printf("Link cable disconnected\n");
+    }
+    gb->serial.fd = -1;
+}
+
+static void link_send(GB *gb, uint8_t type, uint8_t data) {
+    LinkMessage msg = { .type = type, .data = data, .cycle = gb->cycle_count };
+
+    if (gb->serial.fd < 0) return;
+    if (send(gb->serial.fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+        link_close(gb);
+}
+
+static void serial_finish(GB *gb, uint8_t data) {
+    RAM(gb, REG_SB) = data;
+    RAM(gb, REG_SC) &= ~SC_START;
+    REG_IF(gb) |= INT_SERIAL;
+}
+
+static void link_handle(GB *gb, const LinkMessage *msg) {
+    switch (msg->type) {
+        case LINK_XFER:
+            if (gb->serial.active) {
+                // Both sides started on their internal clock: each one
+                // takes the other's XFER as its answer, nobody replies.
+                gb->serial.reply = msg->data;
+                gb->serial.have_reply = true;
+            } else {
+                gb->serial.have_pending = true;
+                gb->serial.pending_at = msg->cycle;
+                gb->serial.pending_data = msg->data;
+            }
+            break;
+        case LINK_REPLY:
+            gb->serial.reply = msg->data;
+            gb->serial.have_reply = true;
+            break;
+    }
+}
+
+// Read every message waiting on the link; with block set, wait for one first
+static void link_poll(GB *gb, bool block) {
+    while (gb->serial.fd >= 0) {
+        struct pollfd pfd = { .fd = gb->serial.fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, block ? -1 : 0);
+
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) return;
+
+        LinkMessage msg;
+        ssize_t n = recv(gb->serial.fd, &msg, sizeof(msg), MSG_WAITALL);
+        if (n != sizeof(msg)) {
+            link_close(gb);
+            return;
+        }
+        link_handle(gb, &msg);
+        block = false;
+    }
+}
+
+int link_listen(GB *gb, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) return -1;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    printf("Waiting for link cable on %s\n", path);
+    gb->serial.fd = accept(fd, NULL, NULL);
+    close(fd);
+    unlink(path);
+    return gb->serial.fd < 0 ? -1 : 0;
+}
+
+int link_connect(GB *gb, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // Give the other instance a few seconds to start listening
+    for (int tries = 0; tries < 50; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            gb->serial.fd = fd;
+            return 0;
+        }
+        close(fd);
+        usleep(100000);
+    }
+    return -1;
+}
+
+void serial_step(GB *gb, int cycles) {
+    (void)cycles; // everything is driven off gb->cycle_count
+
+    // Internal clock: we are the master and drive the transfer
+    if (!gb->serial.active && (RAM(gb, REG_SC) & (SC_START | SC_INTERNAL)) == (SC_START | SC_INTERNAL)) {
+        gb->serial.active = true;
+        gb->serial.have_reply = false;
+        gb->serial.done_at = gb->cycle_count + SERIAL_TRANSFER_CYCLES;
+        link_send(gb, LINK_XFER, RAM(gb, REG_SB));
+        if (gb->serial.log && gb->serial.log_len + 1 < gb->serial.log_size) {
+            gb->serial.log[gb->serial.log_len++] = RAM(gb, REG_SB);
+            gb->serial.log[gb->serial.log_len] = '\0';
+        }
+    }
+
+    if (gb->serial.fd >= 0 && gb->cycle_count >= gb->serial.next_poll) {
+        link_poll(gb, false);
+        gb->serial.next_poll = gb->cycle_count + LINK_POLL_CYCLES;
+    }
+
+    // External clock: once our clock reaches the master's stamp, shift
+    // along with it, finishing on the same cycle the master does. A side
+    // that starts listening, or starts as master itself, before those 8
+    // bits are through still takes part; one that doesn't answers 0xFF.
+    if (gb->serial.have_pending && gb->cycle_count >= gb->serial.pending_at) {
+        if (gb->serial.active && (RAM(gb, REG_SC) & SC_INTERNAL)) {
+            // Both sides are masters: our XFER is the peer's answer and
+            // theirs is ours, as in link_handle
+            gb->serial.have_pending = false;
+            gb->serial.reply = gb->serial.pending_data;
+            gb->serial.have_reply = true;
+        } else if (!gb->serial.active && (RAM(gb, REG_SC) & SC_START)) {
+            gb->serial.have_pending = false;
+            link_send(gb, LINK_REPLY, RAM(gb, REG_SB));
+            gb->serial.active = true;
+            gb->serial.done_at = gb->serial.pending_at + SERIAL_TRANSFER_CYCLES;
+            gb->serial.reply = gb->serial.pending_data;
+            gb->serial.have_reply = true;
+        } else if (gb->cycle_count >= gb->serial.pending_at + SERIAL_TRANSFER_CYCLES) {
+            gb->serial.have_pending = false;
+            link_send(gb, LINK_REPLY, 0xFF); // not listening: line floats high
+        }
+    }
+
+    if (gb->serial.active && gb->cycle_count >= gb->serial.done_at) {
+        // This is the only place a linked instance ever blocks
+        while (!gb->serial.have_reply && gb->serial.fd >= 0)
+            link_poll(gb, true);
+
+        gb->serial.active = false;
+        serial_finish(gb, gb->serial.have_reply ? gb->serial.reply : 0xFF);
+    }
+}
+
+// Execute one instruction (or idle while halted); returns cycles spent
+int cpu_execute_instruction(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    int cycles = handle_interrupts(gb);
 
     if (cpu->halted) {
         // CPU halted: do nothing except wait for interrupt
-        return;
+        return cycles + 4;
     }
 
-    uint8_t opcode = memory[cpu->pc++];
+    uint8_t opcode = mem_read(gb, cpu->pc++);
     if (opcode_table[opcode]) {
-        opcode_table[opcode](cpu);
+        opcode_table[opcode](gb);
+        cycles += opcode_cycles[opcode];
     } else {
-        printf("Unknown opcode 0x%02X at PC=0x%04X\n", opcode, cpu->pc - 1);
+        TRACE(gb, "Unknown opcode 0x%02X at PC=0x%04X\n", opcode, cpu->pc - 1);
+        if (gb->bad_opcode < 0)
+            gb->bad_opcode = opcode;
+        cycles += 4;
     }
+    return cycles;
 }
 
-void load_fake_boot(CPU *cpu) {
+// Run one instruction and clock the rest of the machine to match
+int gb_step(GB *gb) {
+    int cycles = cpu_execute_instruction(gb);
+
+    gb->cycle_count += cycles;
+    ppu_step(gb, cycles);
+    serial_step(gb, cycles);
+    return cycles;
+}
+
+// Run until the PPU reaches V-Blank; a full frame when called back to back
+void gb_run_frame(GB *gb) {
+    gb->frame_done = false;
+    while (!gb->frame_done)
+        gb_step(gb);
+}
+
+void load_fake_boot(GB *gb) {
+    CPU *cpu = &gb->cpu;
+
     cpu->a = 0x01;
     cpu->f = 0xB0;
     cpu->b = 0x00;
@@ -598,71 +954,743 @@ void load_fake_boot(CPU *cpu) {
     cpu->pc = 0x0100; // Skip boot ROM, jump straight to cartridge start
     cpu->ime = true;
 
-    memory[0xFF05] = 0x00; // TIMA
-    memory[0xFF06] = 0x00; // TMA
-    memory[0xFF07] = 0x00; // TAC
-    memory[0xFF10] = 0x80; // NR10
-    memory[0xFF11] = 0xBF; // NR11
-    memory[0xFF12] = 0xF3; // NR12
-    memory[0xFF14] = 0xBF; // NR14
-    memory[0xFF16] = 0x3F; // NR21
-    memory[0xFF17] = 0x00; // NR22
-    memory[0xFF19] = 0xBF; // NR24
-    memory[0xFF1A] = 0x7F; // NR30
-    memory[0xFF1B] = 0xFF; // NR31
-    memory[0xFF1C] = 0x9F; // NR32
-    memory[0xFF1E] = 0xBF; // NR33
-    memory[0xFF20] = 0xFF; // NR41
-    memory[0xFF21] = 0x00; // NR42
-    memory[0xFF22] = 0x00; // NR43
-    memory[0xFF23] = 0xBF; // NR44
-    memory[0xFF24] = 0x77; // NR50
-    memory[0xFF25] = 0xF3; // NR51
-    memory[0xFF26] = 0xF1; // NR52 (GB) or 0xF0 (GBC)
-    memory[0xFF40] = 0x91; // LCDC
-    memory[0xFF42] = 0x00; // SCY
-    memory[0xFF43] = 0x00; // SCX
-    memory[0xFF45] = 0x00; // LYC
-    memory[0xFF47] = 0xFC; // BGP
-    memory[0xFF48] = 0xFF; // OBP0
-    memory[0xFF49] = 0xFF; // OBP1
-    memory[0xFF4A] = 0x00; // WY
-    memory[0xFF4B] = 0x00; // WX
-    memory[0xFFFF] = 0x00; // IE
+    RAM(gb, 0xFF05) = 0x00; // TIMA
+    RAM(gb, 0xFF06) = 0x00; // TMA
+    RAM(gb, 0xFF07) = 0x00; // TAC
+    RAM(gb, 0xFF10) = 0x80; // NR10
+    RAM(gb, 0xFF11) = 0xBF; // NR11
+    RAM(gb, 0xFF12) = 0xF3; // NR12
+    RAM(gb, 0xFF14) = 0xBF; // NR14
+    RAM(gb, 0xFF16) = 0x3F; // NR21
+    RAM(gb, 0xFF17) = 0x00; // NR22
+    RAM(gb, 0xFF19) = 0xBF; // NR24
+    RAM(gb, 0xFF1A) = 0x7F; // NR30
+    RAM(gb, 0xFF1B) = 0xFF; // NR31
+    RAM(gb, 0xFF1C) = 0x9F; // NR32
+    RAM(gb, 0xFF1E) = 0xBF; // NR33
+    RAM(gb, 0xFF20) = 0xFF; // NR41
+    RAM(gb, 0xFF21) = 0x00; // NR42
+    RAM(gb, 0xFF22) = 0x00; // NR43
+    RAM(gb, 0xFF23) = 0xBF; // NR44
+    RAM(gb, 0xFF24) = 0x77; // NR50
+    RAM(gb, 0xFF25) = 0xF3; // NR51
+    RAM(gb, 0xFF26) = 0xF1; // NR52 (GB) or 0xF0 (GBC)
+    RAM(gb, 0xFF40) = 0x91; // LCDC
+    RAM(gb, 0xFF42) = 0x00; // SCY
+    RAM(gb, 0xFF43) = 0x00; // SCX
+    RAM(gb, 0xFF45) = 0x00; // LYC
+    RAM(gb, 0xFF47) = 0xFC; // BGP
+    RAM(gb, 0xFF48) = 0xFF; // OBP0
+    RAM(gb, 0xFF49) = 0xFF; // OBP1
+    RAM(gb, 0xFF4A) = 0x00; // WY
+    RAM(gb, 0xFF4B) = 0x00; // WX
+    RAM(gb, 0xFFFF) = 0x00; // IE
 
     // Clear WRAM for consistency
     for (uint16_t i = 0xC000; i <= 0xDFFF; i++) {
-        memory[i] = 0x00;
+        RAM(gb, i) = 0x00;
     }
 }
 
-int main() {
-    // Set up CPU with interrupts enabled and stack pointer somewhere safe
-    CPU cpu;
-    
-    load_fake_boot(&cpu);
+// Power cycle a machine onto the given cartridge
+void gb_reset(GB *gb, const uint8_t *rom) {
+    uint8_t (*framebuffer)[SCREEN_WIDTH] = gb->framebuffer;
+    bool trace = gb->trace;
+
+    memset(gb, 0, sizeof(*gb));
+    gb->rom = rom;
+    gb->framebuffer = framebuffer;
+    gb->trace = trace;
+    gb->serial.fd = -1;
+    gb->bad_opcode = -1;
+    gb->ppu.mode = 2; // start of line 0
+    load_fake_boot(gb);
+}
 
-    // Enable VBLANK interrupt only for demo
-    *REG_IE = INT_VBLANK;
+#define ROM_SIZE 0x8000 // 32 KiB, no MBC yet
 
-    // Test program
-    memory[0x100] = 0x3E; // LD A, n
-    memory[0x101] = 0x0A; // A = 0x0A
-    memory[0x102] = 0x06; // LD B, n
-    memory[0x103] = 0x05; // B = 0x05
-    memory[0x104] = 0x80; // ADD A, B  (A=0x0A+0x05=0x0F)
-    memory[0x105] = 0xC3; // JP
-    memory[0x106] = 0x08; // second part address to jump to
-    memory[0x107] = 0x01; // first part of address to jump to
-    memory[0x108] = 0x76; // HALT
+// Map the first 32 KiB of a cartridge read only. Every machine running the
+// cartridge points at this one copy.
+const uint8_t *rom_map(const char *path) {
+    struct stat st;
+    void *rom = MAP_FAILED;
+    int fd = open(path, O_RDONLY);
 
-    int cycles = 0;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
 
-    while (!cpu.halted) {
-        cpu_execute_instruction(&cpu);
-        cycles++;
+    if (st.st_size >= ROM_SIZE) {
+        rom = mmap(NULL, ROM_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    } else if (st.st_size > 0x100) {
+        // Too short to map whole pages of: copy it into a zeroed mapping
+        rom = mmap(NULL, ROM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (rom != MAP_FAILED && (pread(fd, rom, st.st_size, 0) != st.st_size ||
+                                  mprotect(rom, ROM_SIZE, PROT_READ) < 0)) {
+            munmap(rom, ROM_SIZE);
+            rom = MAP_FAILED;
+        }
+    } else {
+        fprintf(stderr, "%s: too small to be a ROM\n", path);
+        close(fd);
+        return NULL;
     }
+    close(fd);
+
+    if (rom == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+    return rom;
+}
+
+void rom_unmap(const uint8_t *rom) {
+    munmap((void *)rom, ROM_SIZE);
+}
+
+// Batched machines
+//
+// All machines of a batch run the same cartridge and sit back to back in
+// one allocation, so a batch costs ~32 KiB per machine plus the shared ROM.
+// ggb_batch_step() fans the machines out over a fixed pool of workers that
+// take them a chunk at a time; the caller's thread works as well.
+
+#define BATCH_CHUNK 8 // machines claimed per trip to the shared counter
+
+struct GGBBatch {
+    GB *machines;
+    int count;
+    const uint8_t *rom;
+
+    pthread_t *workers;
+    int nworkers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;  // bumped for every step
+    int busy;             // workers still on the current step
+    bool quit;
+
+    // Current step
+    const uint8_t *inputs;
+    uint8_t *frames;
+    int next;             // next unclaimed machine
+};
+
+static void batch_run(GGBBatch *batch) {
+    const size_t frame_size = SCREEN_HEIGHT * SCREEN_WIDTH;
+    int first;
+
+    while ((first = __atomic_fetch_add(&batch->next, BATCH_CHUNK, __ATOMIC_RELAXED)) < batch->count) {
+        int last = first + BATCH_CHUNK < batch->count ? first + BATCH_CHUNK : batch->count;
+
+        for (int i = first; i < last; i++) {
+            GB *gb = &batch->machines[i];
+            uint8_t pressed = batch->inputs ? batch->inputs[i] : 0;
+
+            if (pressed & ~gb->joypad)
+                REG_IF(gb) |= INT_JOYPAD;
+            gb->joypad = pressed;
+            gb->framebuffer = (uint8_t (*)[SCREEN_WIDTH])(batch->frames + i * frame_size);
+            gb_run_frame(gb);
+        }
+    }
+}
+
+static void *batch_worker(void *arg) {
+    GGBBatch *batch = arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    for (;;) {
+        while (batch->generation == seen && !batch->quit)
+            pthread_cond_wait(&batch->start, &batch->lock);
+        if (batch->quit)
+            break;
+        seen = batch->generation;
+        pthread_mutex_unlock(&batch->lock);
+
+        batch_run(batch);
 
-    printf("Emulation finished.\n");
+        pthread_mutex_lock(&batch->lock);
+        if (--batch->busy == 0)
+            pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+GGBBatch *ggb_batch_create(const char *rom_path, int count, int threads) {
+    GGBBatch *batch = calloc(1, sizeof(*batch));
+
+    if (!batch || count <= 0)
+        goto fail;
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > count)
+        threads = count;
+
+    batch->count = count;
+    batch->rom = rom_map(rom_path);
+    batch->machines = calloc(count, sizeof(GB));
+    batch->workers = calloc(threads, sizeof(pthread_t));
+    if (!batch->rom || !batch->machines || !batch->workers)
+        goto fail;
+
+    for (int i = 0; i < count; i++)
+        gb_reset(&batch->machines[i], batch->rom);
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->start, NULL);
+    pthread_cond_init(&batch->done, NULL);
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&batch->workers[i], NULL, batch_worker, batch) != 0)
+            break;
+        batch->nworkers++;
+    }
+    return batch;
+
+fail:
+    if (batch) {
+        if (batch->rom) rom_unmap(batch->rom);
+        free(batch->machines);
+        free(batch->workers);
+        free(batch);
+    }
+    return NULL;
+}
+
+void ggb_batch_reset(GGBBatch *batch, int index) {
+    if (index >= 0 && index < batch->count)
+        gb_reset(&batch->machines[index], batch->rom);
+}
+
+void ggb_batch_step(GGBBatch *batch, const uint8_t *inputs, uint8_t *frames) {
+    pthread_mutex_lock(&batch->lock);
+    batch->inputs = inputs;
+    batch->frames = frames;
+    batch->next = 0;
+    batch->busy = batch->nworkers;
+    batch->generation++;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+
+    batch_run(batch);
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->busy > 0)
+        pthread_cond_wait(&batch->done, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void ggb_batch_destroy(GGBBatch *batch) {
+    pthread_mutex_lock(&batch->lock);
+    batch->quit = true;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (int i = 0; i < batch->nworkers; i++)
+        pthread_join(batch->workers[i], NULL);
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->start);
+    pthread_cond_destroy(&batch->done);
+    rom_unmap(batch->rom);
+    free(batch->machines);
+    free(batch->workers);
+    free(batch);
+}
+
+#ifndef GGB_NO_MAIN
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Step a batch with random inputs and report throughput
+int run_batch(const char *rom, int count, int frames, int threads) {
+    GGBBatch *batch = ggb_batch_create(rom, count, threads);
+    uint8_t *inputs = malloc(count);
+    uint8_t *screens = malloc((size_t)count * SCREEN_HEIGHT * SCREEN_WIDTH);
+
+    if (!batch || !inputs || !screens) {
+        fprintf(stderr, "Could not set up a batch of %d machines\n", count);
+        return 1;
+    }
+
+    unsigned seed = 1;
+    double start = now_seconds();
+    for (int f = 0; f < frames; f++) {
+        for (int i = 0; i < count; i++) {
+            seed = seed * 1103515245 + 12345;
+            inputs[i] = seed >> 24;
+        }
+        ggb_batch_step(batch, inputs, screens);
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("%d machines x %d frames on %d threads: %.3f s, %.0f frames/s\n",
+           count, frames, batch->nworkers + 1, elapsed, count * (double)frames / elapsed);
+
+    ggb_batch_destroy(batch);
+    free(inputs);
+    free(screens);
+    return 0;
+}
+
+// Test ROM runner
+//
+// Runs a set of test ROMs headless, several at a time, and decides each one
+// from what the ROM itself reports:
+//  - Blargg ROMs print "Passed"/"Failed" over the serial port, and also
+//    leave a status byte at 0xA000 behind the signature DE B0 61.
+//  - Mooneye ROMs finish on LD B, B with B/C/D/E/H/L holding the Fibonacci
+//    numbers 3/5/8/13/21/34 on success.
+// Anything else ends as a hang, a timeout or an unimplemented opcode.
+
+#define CLOCK_HZ 4194304
+#define TEST_CHECK_CYCLES 65536 // how often the slower checks run
+#define TEST_LOG_SIZE 4096
+
+typedef enum {
+    TEST_PASS,
+    TEST_FAIL,
+    TEST_HANG,
+    TEST_TIMEOUT,
+    TEST_UNIMPL,
+    TEST_ERROR,
+} TestResult;
+
+static const char *test_result_names[] = {
+    [TEST_PASS] = "PASS",
+    [TEST_FAIL] = "FAIL",
+    [TEST_HANG] = "HANG",
+    [TEST_TIMEOUT] = "TIMEOUT",
+    [TEST_UNIMPL] = "UNIMPL",
+    [TEST_ERROR] = "ERROR",
+};
+
+typedef struct {
+    const char *path;
+    TestResult result;
+    char detail[48];      // what decided the result
+    uint64_t cycles;
+    double seconds;
+    uint64_t frame_hash;  // FNV-1a of the last frame drawn
+} TestJob;
+
+typedef struct {
+    TestJob *jobs;
+    int count;
+    int next;
+    uint64_t max_cycles;
+} TestRun;
+
+static uint64_t frame_hash(uint8_t (*framebuffer)[SCREEN_WIDTH]) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            hash ^= framebuffer[y][x];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+// Stuck for good: halted with nothing to wake us, or jumping to ourselves
+// with no interrupt able to get us out
+static bool test_hung(GB *gb) {
+    CPU *cpu = &gb->cpu;
+    bool wakeable = (REG_IE(gb) & 0x1F) != 0;
+
+    if (cpu->halted)
+        return !wakeable;
+    return mem_read(gb, cpu->pc) == 0xC3 &&
+           (mem_read(gb, cpu->pc + 1) | (mem_read(gb, cpu->pc + 2) << 8)) == cpu->pc &&
+           (!cpu->ime || !wakeable);
+}
+
+static void run_test(TestJob *job, uint64_t max_cycles) {
+    uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH] = { { 0 } };
+    char log[TEST_LOG_SIZE];
+    size_t log_seen = 0;
+    uint64_t next_check = TEST_CHECK_CYCLES;
+    double start = now_seconds();
+    const uint8_t *rom = rom_map(job->path);
+    GB *gb = malloc(sizeof(GB));
+
+    job->result = TEST_TIMEOUT;
+    snprintf(job->detail, sizeof(job->detail), "no result after %.0f s",
+             (double)max_cycles / CLOCK_HZ);
+
+    if (!rom || !gb) {
+        job->result = TEST_ERROR;
+        snprintf(job->detail, sizeof(job->detail), "could not load ROM");
+        goto out;
+    }
+
+    gb->trace = false;
+    gb->framebuffer = framebuffer;
+    gb_reset(gb, rom);
+    log[0] = '\0';
+    gb->serial.log = log;
+    gb->serial.log_size = sizeof(log);
+
+    while (gb->cycle_count < max_cycles) {
+        gb_step(gb);
+
+        if (gb->breakpoint) {
+            CPU *cpu = &gb->cpu;
+            bool fib = cpu->b == 3 && cpu->c == 5 && cpu->d == 8 &&
+                       cpu->e == 13 && cpu->h == 21 && cpu->l == 34;
+
+            job->result = fib ? TEST_PASS : TEST_FAIL;
+            snprintf(job->detail, sizeof(job->detail), "mooneye registers %s",
+                     fib ? "ok" : "wrong");
+            break;
+        }
+        if (gb->bad_opcode >= 0) {
+            job->result = TEST_UNIMPL;
+            snprintf(job->detail, sizeof(job->detail), "opcode 0x%02X at 0x%04X",
+                     gb->bad_opcode, (uint16_t)(gb->cpu.pc - 1));
+            break;
+        }
+        if (gb->serial.log_len != log_seen) {
+            log_seen = gb->serial.log_len;
+            if (strstr(log, "Passed")) {
+                job->result = TEST_PASS;
+                snprintf(job->detail, sizeof(job->detail), "blargg serial");
+                break;
+            }
+            if (strstr(log, "Failed")) {
+                job->result = TEST_FAIL;
+                snprintf(job->detail, sizeof(job->detail), "blargg serial");
+                break;
+            }
+        }
+
+        if (gb->cycle_count >= next_check) {
+            next_check = gb->cycle_count + TEST_CHECK_CYCLES;
+
+            // Blargg's memory report; 0x80 means still running
+            if (RAM(gb, 0xA001) == 0xDE && RAM(gb, 0xA002) == 0xB0 &&
+                RAM(gb, 0xA003) == 0x61 && RAM(gb, 0xA000) != 0x80) {
+                job->result = RAM(gb, 0xA000) == 0 ? TEST_PASS : TEST_FAIL;
+                snprintf(job->detail, sizeof(job->detail), "blargg status 0x%02X",
+                         RAM(gb, 0xA000));
+                break;
+            }
+            if (test_hung(gb)) {
+                job->result = TEST_HANG;
+                snprintf(job->detail, sizeof(job->detail), "stuck at 0x%04X", gb->cpu.pc);
+                break;
+            }
+        }
+    }
+
+    job->cycles = gb->cycle_count;
+    job->frame_hash = frame_hash(framebuffer);
+
+out:
+    job->seconds = now_seconds() - start;
+    if (rom) rom_unmap(rom);
+    free(gb);
+}
+
+static void *test_worker(void *arg) {
+    TestRun *run = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < run->count)
+        run_test(&run->jobs[i], run->max_cycles);
+    return NULL;
+}
+
+// Run every ROM given, print a summary table; exits non-zero on any failure
+int run_tests(char **roms, int count, int jobs, double timeout) {
+    TestRun run = {
+        .jobs = calloc(count, sizeof(TestJob)),
+        .count = count,
+        .max_cycles = timeout * CLOCK_HZ,
+    };
+    pthread_t *threads;
+    int started = 0, passed = 0;
+    double start = now_seconds();
+
+    if (jobs <= 0)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > count)
+        jobs = count;
+    threads = calloc(jobs, sizeof(pthread_t));
+    if (!run.jobs || !threads) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+        run.jobs[i].path = roms[i];
+
+    for (int i = 1; i < jobs; i++) {
+        if (pthread_create(&threads[started], NULL, test_worker, &run) == 0)
+            started++;
+    }
+    test_worker(&run);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("%-40s %-8s %-28s %14s %10s  %s\n", "ROM", "RESULT", "DETAIL", "CYCLES", "WALL", "FRAME");
+    for (int i = 0; i < count; i++) {
+        TestJob *job = &run.jobs[i];
+        const char *name = strrchr(job->path, '/') ? strrchr(job->path, '/') + 1 : job->path;
+
+        printf("%-40s %-8s %-28s %14llu %9.3fs  %016llx\n", name,
+               test_result_names[job->result], job->detail,
+               (unsigned long long)job->cycles, job->seconds,
+               (unsigned long long)job->frame_hash);
+        if (job->result == TEST_PASS)
+            passed++;
+    }
+    printf("\n%d/%d passed in %.3f s on %d threads\n", passed, count,
+           now_seconds() - start, started + 1);
+
+    free(run.jobs);
+    free(threads);
+    return passed == count ? 0 : 1;
+}
+
+// Run a machine until it executes STOP, hangs for good or reaches
+// max_cycles (0 for no limit). HALT alone doesn't end the run: games HALT
+// to wait for V-Blank or for a serial transfer to finish.
+static void run_until_stopped(GB *gb, uint64_t max_cycles) {
+    uint64_t next_check = TEST_CHECK_CYCLES;
+
+    while (!gb->cpu.stopped && (!max_cycles || gb->cycle_count < max_cycles)) {
+        gb_step(gb);
+        if (gb->cycle_count >= next_check) {
+            next_check = gb->cycle_count + TEST_CHECK_CYCLES;
+            if (test_hung(gb))
+                break;
+        }
+    }
+}
+
+// Link cable self test
+//
+// Pairs a listening and a connecting instance, each in its own process,
+// over a socket in /tmp. Both run a built-in ROM that loads SB, starts a
+// transfer and HALTs until INT_SERIAL, whose handler executes STOP; each
+// side must end up with the other's byte.
+
+#define LINK_TEST_CYCLES (1 << 22) // a second of emulated time
+
+typedef struct {
+    uint8_t sc;     // 0x81 master, 0x80 slave
+    uint8_t data;
+    int delay;      // NOPs before starting
+} LinkTestSide;
+
+static const struct {
+    const char *name;
+    LinkTestSide listener, connector;
+} link_tests[] = {
+    { "master and slave",              { 0x81, 0x24, 0 }, { 0x80, 0x42, 0 } },
+    { "slave and master",              { 0x80, 0x24, 0 }, { 0x81, 0x42, 0 } },
+    { "two masters together",          { 0x81, 0x24, 0 }, { 0x81, 0x42, 0 } },
+    { "two masters, 5 NOPs apart",     { 0x81, 0x24, 0 }, { 0x81, 0x42, 5 } },
+    { "two masters, 5 NOPs the other way", { 0x81, 0x24, 5 }, { 0x81, 0x42, 0 } },
+};
+
+static void link_test_rom(uint8_t *rom, const LinkTestSide *side) {
+    uint8_t *p = rom + 0x100;
+
+    memset(rom, 0, ROM_SIZE);
+    rom[0x58] = 0x10; // serial handler: STOP
+    for (int i = 0; i < side->delay; i++)
+        *p++ = 0x00;                                // NOP
+    *p++ = 0x3E; *p++ = INT_SERIAL;                 // LD A, INT_SERIAL
+    *p++ = 0xE0; *p++ = 0xFF;                       // LDH (IE), A
+    *p++ = 0x3E; *p++ = side->data;                 // LD A, data
+    *p++ = 0xE0; *p++ = REG_SB & 0xFF;              // LDH (SB), A
+    *p++ = 0x3E; *p++ = side->sc;                   // LD A, sc
+    *p++ = 0xE0; *p++ = REG_SC & 0xFF;              // LDH (SC), A
+    *p++ = 0x76;                                    // HALT
+    *p++ = 0x10;                                    // STOP
+}
+
+// Run one side of a test; returns the byte it received or -1
+static int link_test_side(const LinkTestSide *side, const char *path, bool listening) {
+    static GB machine;
+    static uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+    static uint8_t rom[ROM_SIZE];
+    GB *gb = &machine;
+
+    link_test_rom(rom, side);
+    gb->trace = false;
+    gb->framebuffer = framebuffer;
+    gb_reset(gb, rom);
+    if ((listening ? link_listen(gb, path) : link_connect(gb, path)) < 0) {
+        fprintf(stderr, "Link cable on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    run_until_stopped(gb, LINK_TEST_CYCLES);
+    link_close(gb);
+    return gb->cpu.stopped && !(RAM(gb, REG_SC) & SC_START) ? RAM(gb, REG_SB) : -1;
+}
+
+int run_link_selftest(void) {
+    char path[64];
+    int failed = 0;
+
+    snprintf(path, sizeof(path), "/tmp/ggb-link-%d", (int)getpid());
+    for (size_t t = 0; t < sizeof(link_tests) / sizeof(link_tests[0]); t++) {
+        const LinkTestSide *a = &link_tests[t].listener, *b = &link_tests[t].connector;
+        int got_a, got_b = -1, status;
+        pid_t pid;
+
+        fflush(stdout);
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            // The exit status only has room for a byte: report failure as
+            // the byte we sent, which is never the right answer
+            int got = link_test_side(b, path, false);
+            _exit(got < 0 ? b->data : got);
+        }
+        got_a = link_test_side(a, path, true);
+        if (waitpid(pid, &status, 0) == pid && WIFEXITED(status))
+            got_b = WEXITSTATUS(status);
+
+        bool ok = got_a == b->data && got_b == a->data;
+
+        printf("%-36s %s  listener read 0x%02X, connector read 0x%02X\n", link_tests[t].name,
+               ok ? "ok  " : "FAIL", got_a & 0xFF, got_b & 0xFF);
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--link-listen PATH | --link-connect PATH] [--cycles N] [ROM]\n", prog);
+    fprintf(stderr, "       %s --batch N [--frames F] [--threads T] ROM\n", prog);
+    fprintf(stderr, "       %s --test [--jobs J] [--timeout SECONDS] ROM...\n", prog);
+    fprintf(stderr, "       %s --link-selftest\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static GB machine;
+    static uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+    static uint8_t demo_rom[ROM_SIZE];
+    GB *gb = &machine;
+    const char *link_path = NULL;
+    bool link_listening = false;
+    const char *rom_path = NULL;
+    int batch = 0, frames = 60, threads = 0;
+    uint64_t max_cycles = 0;
+
+    if (argc == 2 && !strcmp(argv[1], "--link-selftest"))
+        return run_link_selftest();
+    if (argc > 1 && !strcmp(argv[1], "--test")) {
+        int jobs = 0, first = 2;
+        double timeout = 60; // emulated seconds
+
+        for (; first < argc && argv[first][0] == '-'; first++) {
+            if (!strcmp(argv[first], "--jobs") && first + 1 < argc) {
+                jobs = atoi(argv[++first]);
+            } else if (!strcmp(argv[first], "--timeout") && first + 1 < argc) {
+                timeout = atof(argv[++first]);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        if (first == argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_tests(argv + first, argc - first, jobs, timeout);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if ((!strcmp(argv[i], "--link-listen") || !strcmp(argv[i], "--link-connect")) && i + 1 < argc) {
+            link_listening = !strcmp(argv[i], "--link-listen");
+            link_path = argv[++i];
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            max_cycles = strtoull(argv[++i], NULL, 0);
+        } else if (argv[i][0] != '-' && !rom_path) {
+            rom_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch > 0) {
+        if (!rom_path) {
+            usage(argv[0]);
+            return 1;
+        }
+        return run_batch(rom_path, batch, frames, threads);
+    }
+
+    const uint8_t *rom = demo_rom;
+    if (rom_path) {
+        rom = rom_map(rom_path);
+        if (!rom)
+            return 1;
+    } else {
+        // Test program
+        demo_rom[0x100] = 0x3E; // LD A, n
+        demo_rom[0x101] = 0x0A; // A = 0x0A
+        demo_rom[0x102] = 0x06; // LD B, n
+        demo_rom[0x103] = 0x05; // B = 0x05
+        demo_rom[0x104] = 0x80; // ADD A, B  (A=0x0A+0x05=0x0F)
+        demo_rom[0x105] = 0xC3; // JP
+        demo_rom[0x106] = 0x08; // second part address to jump to
+        demo_rom[0x107] = 0x01; // first part of address to jump to
+        demo_rom[0x108] = 0x76; // HALT
+        demo_rom[0x040] = 0x10; // V-Blank handler: STOP
+        demo_rom[0x041] = 0x00;
+    }
+
+    // Set up CPU with interrupts enabled and stack pointer somewhere safe
+    gb->trace = true;
+    gb->framebuffer = framebuffer;
+    gb_reset(gb, rom);
+
+    if (!rom_path) {
+        // Enable VBLANK interrupt only for demo
+        REG_IE(gb) = INT_VBLANK;
+    }
+
+    if (link_path) {
+        if ((link_listening ? link_listen(gb, link_path) : link_connect(gb, link_path)) < 0) {
+            fprintf(stderr, "Link cable on %s: %s\n", link_path, strerror(errno));
+            return 1;
+        }
+        printf("Link cable connected on %s\n", link_path);
+    }
+
+    run_until_stopped(gb, max_cycles);
+
+    printf("Emulation finished after %llu cycles.\n", (unsigned long long)gb->cycle_count);
+    link_close(gb);
+    if (rom_path)
+        rom_unmap(rom);
     return 0;
 }
+
+#endif // GGB_NO_MAIN
@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * ggb/ggb.h
+ *
+ * Batched interface to ggb, for stepping many machines at once.
+ * Build ggb.c with -DGGB_NO_MAIN to link it into another program.
+ *
+ * Copyright (C) 2025 Goldside543
+ *
+ */
+
+#ifndef GGB_H
+#define GGB_H
+
+#include <stdint.h>
+
+#define GGB_SCREEN_WIDTH 160
+#define GGB_SCREEN_HEIGHT 144
+
+// Joypad buttons, OR'd together into one input byte per machine
+#define GGB_BTN_RIGHT  0x01
+#define GGB_BTN_LEFT   0x02
+#define GGB_BTN_UP     0x04
+#define GGB_BTN_DOWN   0x08
+#define GGB_BTN_A      0x10
+#define GGB_BTN_B      0x20
+#define GGB_BTN_SELECT 0x40
+#define GGB_BTN_START  0x80
+
+typedef struct GGBBatch GGBBatch;
+
+// Boot count machines on the ROM at rom_path, stepped by a pool of
+// threads (0 = one per CPU). Returns NULL on failure.
+GGBBatch *ggb_batch_create(const char *rom_path, int count, int threads);
+
+// Power cycle one machine of the batch
+void ggb_batch_reset(GGBBatch *batch, int index);
+
+// Run every machine for one frame. inputs holds count button bytes (or is
+// NULL for no buttons); frames receives [count][144][160] shade indices.
+// Nothing is allocated per step.
+void ggb_batch_step(GGBBatch *batch, const uint8_t *inputs, uint8_t *frames);
+
+void ggb_batch_destroy(GGBBatch *batch);
+
+#endif // GGB_H
@@ -10,9 +10,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <termios.h>
-#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #define WIDTH 80
 #define HEIGHT 24
@@ -22,6 +32,9 @@
 #define EMPTY_CHAR ' '
 #define WINNING_SCORE 10
 #define CENTER_LINE_CHAR '|'
+#define TICK_RATE 20          // simulation ticks per second
+#define MAX_CATCHUP_TICKS 5   // ticks run back to back before giving up on the backlog
+#define MAX_STAT_SAMPLES 65536
 
 // Structures for Ball, Paddle, and Game Mode
 typedef struct {
@@ -43,54 +56,128 @@ typedef enum {
     MULTIPLAYER
 } GameMode;
 
+// Paddle moves asked for since the last tick; negative is up
+typedef struct {
+    int left_dy;
+    int right_dy;
+} Input;
+
+// Everything one game needs, so any number of games can run side by side
+typedef struct {
+    Ball ball;
+    Paddle left_paddle;
+    Paddle right_paddle;
+    GameMode mode;
+    int ai_speed;       // right paddle AI speed; 0 adapts to the score
+    int left_ai_speed;  // left paddle AI speed, or 0 when input drives it
+    int left_score;
+    int right_score;
+    int winner;         // 0 while playing, then 1 or 2
+    int rally;          // paddle hits since the last serve
+    int last_rally;     // length of the rally that ended the last point
+    unsigned int rng;   // per-game random state, never 0
+} Game;
+
 // Function to clear the screen
 void clear_screen() {
     printf("\033[H\033[J");
 }
 
+// Terminal rows: the scoreboard, then the playfield
+#define SCREEN_ROWS (HEIGHT + 1)
+
+// What the terminal currently shows, and the frame being built. Cells are
+// row-major, the same order they go out to the terminal in.
+static char front[SCREEN_ROWS][WIDTH];
+static char back[SCREEN_ROWS][WIDTH];
+static int front_valid; // 0 until the terminal holds a full frame of ours
+
+// Worst case every cell needs its own cursor move
+static char frame_out[SCREEN_ROWS * WIDTH * 12 + 64];
+
+// Forget what's on the terminal, so the next frame repaints everything
+void invalidate_screen() {
+    front_valid = 0;
+}
+
 // Function to draw the game frame
-void draw_frame(Ball *ball, Paddle *left_paddle, Paddle *right_paddle, int left_score, int right_score) {
-    char screen[WIDTH][HEIGHT];
+//
+// Only cells that differ from the last frame are sent, each run of them
+// preceded by a cursor move, and the whole frame goes out in one write.
+// Returns the number of bytes sent.
+size_t draw_frame(const Game *game) {
+    const Ball *ball = &game->ball;
+    const Paddle *left_paddle = &game->left_paddle;
+    const Paddle *right_paddle = &game->right_paddle;
+    char *out = frame_out;
 
-    // Initialize screen with empty characters
-    for (int x = 0; x < WIDTH; x++) {
-        for (int y = 0; y < HEIGHT; y++) {
-            screen[x][y] = EMPTY_CHAR;
-        }
-    }
+    // Draw scoreboard
+    char scoreboard[WIDTH + 1];
+    int n = snprintf(scoreboard, sizeof(scoreboard), "Scoreboard: Player 1: %d  |  Player 2: %d", game->left_score, game->right_score);
+    memset(back[0], EMPTY_CHAR, WIDTH);
+    memcpy(back[0], scoreboard, n < WIDTH ? n : WIDTH);
+
+    // Initialize playfield with empty characters
+    memset(back[1], EMPTY_CHAR, sizeof(back) - sizeof(back[0]));
 
     // Draw paddles
     for (int i = 0; i < left_paddle->height; i++) {
         if (left_paddle->pos.y + i < HEIGHT) {
-            screen[left_paddle->pos.x][left_paddle->pos.y + i] = PADDLE_CHAR;
+            back[1 + left_paddle->pos.y + i][left_paddle->pos.x] = PADDLE_CHAR;
         }
     }
 
     for (int i = 0; i < right_paddle->height; i++) {
         if (right_paddle->pos.y + i < HEIGHT) {
-            screen[right_paddle->pos.x][right_paddle->pos.y + i] = PADDLE_CHAR;
+            back[1 + right_paddle->pos.y + i][right_paddle->pos.x] = PADDLE_CHAR;
         }
     }
 
     // Draw ball
     if (ball->pos.y < HEIGHT && ball->pos.x < WIDTH) {
-        screen[ball->pos.x][ball->pos.y] = BALL_CHAR;
+        back[1 + ball->pos.y][ball->pos.x] = BALL_CHAR;
     }
 
     // Draw center line
     for (int y = 0; y < HEIGHT; y++) {
-        screen[WIDTH / 2][y] = CENTER_LINE_CHAR;
+        back[1 + y][WIDTH / 2] = CENTER_LINE_CHAR;
     }
 
-    // Draw scoreboard
-    clear_screen(); // Clear the previous frame
-    printf("Scoreboard: Player 1: %d  |  Player 2: %d\n", left_score, right_score);
-    for (int y = 0; y < HEIGHT; y++) {
+    if (!front_valid) {
+        fflush(stdout); // anything printf'd must land before our write
+        out += sprintf(out, "\033[H\033[J");
+        memset(front, 0, sizeof(front)); // matches no cell
+        front_valid = 1;
+    }
+
+    for (int y = 0; y < SCREEN_ROWS; y++) {
+        int cursor_x = -1; // column the terminal cursor is at, if on this row
+
         for (int x = 0; x < WIDTH; x++) {
-            printf("%c", screen[x][y]);
+            if (back[y][x] == front[y][x])
+                continue;
+            if (x != cursor_x)
+                out += sprintf(out, "\033[%d;%dH", y + 1, x + 1);
+            *out++ = back[y][x];
+            front[y][x] = back[y][x];
+            cursor_x = x + 1;
+        }
+    }
+
+    // Park the cursor below the playfield
+    if (out != frame_out)
+        out += sprintf(out, "\033[%d;1H", SCREEN_ROWS + 1);
+
+    for (char *p = frame_out; p < out; ) {
+        ssize_t written = write(STDOUT_FILENO, p, out - p);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
         }
-        printf("\n");
+        p += written;
     }
+    return out - frame_out;
 }
 
 // Function to draw the title screen
@@ -115,12 +202,16 @@ void draw_title_screen(GameMode *mode) {
     printf("*                                              *\n");
     printf("*        Press 1 for Single Player             *\n");
     printf("*        Press 2 for Multiplayer               *\n");
+    printf("*        Press q during play to quit           *\n");
     printf("************************************************\n");
 
+    fflush(stdout);
+
     // Wait for user input to select the game mode
     char c;
     while (1) {
-        c = getchar();
+        if (read(STDIN_FILENO, &c, 1) != 1)
+            exit(0);
         if (c == '1') {
             *mode = SINGLE_PLAYER;
             break;
@@ -131,29 +222,180 @@ void draw_title_screen(GameMode *mode) {
     }
 }
 
-// Function to check if a key is pressed
-int kbhit() {
-    struct termios oldt, newt;
-    int ch;
-    int oldf;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-    oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-    ch = getchar();
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    fcntl(STDIN_FILENO, F_SETFL, oldf);
-    if(ch != EOF) {
-        ungetc(ch, stdin);
-        return 1;
+// The terminal stays in raw mode for the whole game, and is put back the
+// way we found it on exit or on a fatal signal.
+static struct termios saved_termios;
+static volatile sig_atomic_t raw_mode;
+
+static void restore_terminal(void) {
+    if (!raw_mode)
+        return;
+    raw_mode = 0;
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+    (void)!write(STDOUT_FILENO, "\033[?25h", 6); // show the cursor again
+}
+
+static void restore_terminal_on_signal(int sig) {
+    restore_terminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+// Function to switch the terminal to unbuffered, unechoed input
+void enter_raw_mode() {
+    struct termios raw;
+    struct sigaction sa = { .sa_handler = restore_terminal_on_signal };
+    int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT };
+
+    if (tcgetattr(STDIN_FILENO, &saved_termios) < 0)
+        return; // not a terminal, nothing to change
+
+    raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0)
+        return;
+    raw_mode = 1;
+
+    atexit(restore_terminal);
+    sigemptyset(&sa.sa_mask);
+    for (unsigned i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        sigaction(signals[i], &sa, NULL);
+
+    printf("\033[?25l"); // hide the cursor while playing
+}
+
+// Function to read the monotonic clock in nanoseconds
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Keys are read on their own thread as soon as they arrive and folded into
+// pending_input; each tick takes everything gathered since the last one.
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+static Input pending_input;
+static long long pending_since; // arrival of the oldest key not yet taken
+static int quit_requested;
+
+static void *input_thread(void *arg) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    char keys[64];
+
+    (void)arg;
+    while (1) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        ssize_t n = read(STDIN_FILENO, keys, sizeof(keys));
+        if (n <= 0)
+            break; // stdin closed
+
+        long long arrived = now_ns();
+
+        pthread_mutex_lock(&input_lock);
+        if (!pending_since)
+            pending_since = arrived;
+        for (ssize_t i = 0; i < n; i++) {
+            switch (keys[i]) {
+                case 'w': pending_input.left_dy--; break;
+                case 's': pending_input.left_dy++; break;
+                case 'i': pending_input.right_dy--; break;
+                case 'k': pending_input.right_dy++; break;
+                case 'q': quit_requested = 1; break;
+            }
+        }
+        pthread_mutex_unlock(&input_lock);
+    }
+    return NULL;
+}
+
+// Function to start reading keys in the background
+void start_input() {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, input_thread, NULL) == 0)
+        pthread_detach(thread);
+}
+
+// Function to collect the keys pressed since the last call. since gets the
+// arrival time of the oldest of them (0 for none); returns 1 on quit.
+int take_input(Input *input, long long *since) {
+    pthread_mutex_lock(&input_lock);
+    *input = pending_input;
+    *since = pending_since;
+    memset(&pending_input, 0, sizeof(pending_input));
+    pending_since = 0;
+    pthread_mutex_unlock(&input_lock);
+    return quit_requested;
+}
+
+// Function to move a paddle, keeping it on the field
+void move_paddle(Paddle *paddle, int dy) {
+    paddle->pos.y += dy;
+    if (paddle->pos.y < 0) {
+        paddle->pos.y = 0;
+    } else if (paddle->pos.y > HEIGHT - paddle->height) {
+        paddle->pos.y = HEIGHT - paddle->height;
+    }
+}
+
+// Function to draw a random number from the game's own generator
+// (xorshift32, so a seed replays the exact same game)
+unsigned int game_rand(Game *game) {
+    unsigned int x = game->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return game->rng = x;
+}
+
+// Function to serve the ball from the center in a random direction. The
+// columns the paddles hit in are an odd number apart, so the ball starts
+// on whichever middle column leaves the receiver the same distance.
+void serve_ball(Game *game) {
+    game->ball.pos.y = HEIGHT / 2;
+    game->ball.dir.x = (game_rand(game) % 2) ? 1 : -1;
+    game->ball.dir.y = (game_rand(game) % 2) ? 1 : -1;
+    game->ball.pos.x = game->ball.dir.x < 0 ? WIDTH / 2 : WIDTH / 2 - 1;
+}
+
+// Function to set up a fresh game
+void new_game(Game *game, GameMode mode, int ai_speed, unsigned int seed) {
+    Game fresh = {
+        .ball = {{WIDTH / 2, HEIGHT / 2}, {1, 1}},
+        .left_paddle = {{1, HEIGHT / 2 - PADDLE_HEIGHT / 2}, PADDLE_HEIGHT},
+        .right_paddle = {{WIDTH - 2, HEIGHT / 2 - PADDLE_HEIGHT / 2}, PADDLE_HEIGHT},
+        .mode = mode,
+        .ai_speed = ai_speed,
+        .rng = seed ? seed : 1,
+    };
+    *game = fresh;
+}
+
+// Function to pick the AI's move for a paddle chasing the ball
+int ai_move(const Ball *ball, const Paddle *paddle, int speed) {
+    if (ball->pos.y < paddle->pos.y) {
+        return -speed;
+    } else if (ball->pos.y > paddle->pos.y + paddle->height - 1) {
+        return speed;
     }
     return 0;
 }
 
-// Function to update the game state
-void update_game(Ball *ball, Paddle *left_paddle, Paddle *right_paddle, GameMode mode, int *left_score, int *right_score) {
+// Function to update the game state. Returns 1 when a point was scored;
+// game->winner is set once a player reaches WINNING_SCORE.
+int update_game(Game *game, const Input *input) {
+    Ball *ball = &game->ball;
+    Paddle *left_paddle = &game->left_paddle;
+    Paddle *right_paddle = &game->right_paddle;
+    int scored = 0;
+
     ball->pos.x += ball->dir.x;
     ball->pos.y += ball->dir.y;
 
@@ -167,103 +409,812 @@ void update_game(Ball *ball, Paddle *left_paddle, Paddle *right_paddle, GameMode
         ball->pos.y >= left_paddle->pos.y &&
         ball->pos.y < left_paddle->pos.y + left_paddle->height) {
         ball->dir.x = -ball->dir.x;
+        game->rally++;
     }
 
     if (ball->pos.x == right_paddle->pos.x - 1 &&
         ball->pos.y >= right_paddle->pos.y &&
         ball->pos.y < right_paddle->pos.y + right_paddle->height) {
         ball->dir.x = -ball->dir.x;
+        game->rally++;
     }
 
     // Ball out of bounds
     if (ball->pos.x <= 0) {
-        (*right_score)++;
-        if (*right_score >= WINNING_SCORE) {
-            clear_screen();
-            printf("Player 2 Wins!\n");
-            exit(0);
-        }
-        ball->pos.x = WIDTH / 2;
-        ball->pos.y = HEIGHT / 2;
-        ball->dir.x = (rand() % 2) ? 1 : -1;
-        ball->dir.y = (rand() % 2) ? 1 : -1;
+        game->right_score++;
+        scored = 1;
     } else if (ball->pos.x >= WIDTH - 1) {
-        (*left_score)++;
-        if (*left_score >= WINNING_SCORE) {
-            clear_screen();
-            printf("Player 1 Wins!\n");
-            exit(0);
+        game->left_score++;
+        scored = 1;
+    }
+    if (scored) {
+        game->last_rally = game->rally;
+        game->rally = 0;
+        if (game->right_score >= WINNING_SCORE) {
+            game->winner = 2;
+        } else if (game->left_score >= WINNING_SCORE) {
+            game->winner = 1;
         }
-        ball->pos.x = WIDTH / 2;
-        ball->pos.y = HEIGHT / 2;
-        ball->dir.x = (rand() % 2) ? 1 : -1;
-        ball->dir.y = (rand() % 2) ? 1 : -1;
-    }
-
-    // Move paddles
-    if (kbhit()) {
-        char c = getchar();
-        if (mode == MULTIPLAYER) {
-            // Player controls for both paddles in Multiplayer mode
-            if (c == 'w' && left_paddle->pos.y > 0) {
-                left_paddle->pos.y--;
-            } else if (c == 's' && left_paddle->pos.y < HEIGHT - left_paddle->height) {
-                left_paddle->pos.y++;
-            } else if (c == 'i' && right_paddle->pos.y > 0) {
-                right_paddle->pos.y--;
-            } else if (c == 'k' && right_paddle->pos.y < HEIGHT - right_paddle->height) {
-                right_paddle->pos.y++;
-            }
-        } else if (mode == SINGLE_PLAYER) {
-            // Player controls for left paddle in Single Player mode
-            if (c == 'w' && left_paddle->pos.y > 0) {
-                left_paddle->pos.y--;
-            } else if (c == 's' && left_paddle->pos.y < HEIGHT - left_paddle->height) {
-                left_paddle->pos.y++;
+        serve_ball(game);
+    }
+
+    // Move paddles. Both AIs see the ball where it is now, after its move.
+    if (game->left_ai_speed) {
+        move_paddle(left_paddle, ai_move(ball, left_paddle, game->left_ai_speed));
+    } else {
+        move_paddle(left_paddle, input->left_dy);
+    }
+    if (game->mode == MULTIPLAYER) {
+        // Player 2 controls the right paddle in Multiplayer mode
+        move_paddle(right_paddle, input->right_dy);
+    }
+
+    // AI for right paddle in Single Player mode
+    if (game->mode == SINGLE_PLAYER) {
+        int ai_speed = game->ai_speed;
+
+        if (!ai_speed) {
+            // Slow down AI if its score is high and the player's score is low
+            if (game->right_score > 5 && game->left_score < 5) {
+                ai_speed = 1; // Slow down AI
+            } else {
+                ai_speed = 2; // Normal AI speed
             }
         }
+
+        move_paddle(right_paddle, ai_move(ball, right_paddle, ai_speed));
     }
 
-    // AI for right paddle in Single Player mode
-    if (mode == SINGLE_PLAYER) {
-        int ai_speed = 1;
+    return scored;
+}
+
+// Headless simulation
+//
+// Plays the right paddle AI against a scripted or AI left paddle with no
+// drawing and no sleeping, spread over every core, and reports how each
+// ai_speed setting fares. Game n of a run is always seeded the same, so
+// runs are reproducible for any thread count.
+
+#define SIM_CHUNK 256           // games claimed per trip to the shared counter
+#define MAX_GAME_TICKS 200000   // longer than this is scored as a draw
+#define MAX_RALLY 255           // longer rallies share the last bucket
+#define MAX_SIM_SETTINGS 8
+
+typedef struct {
+    long long games;
+    long long left_wins;
+    long long right_wins;
+    long long draws;
+    long long ticks;
+    long long rallies[MAX_RALLY + 1];   // points ended after N paddle hits
+} SimResult;
+
+typedef struct {
+    int speeds[MAX_SIM_SETTINGS];  // ai_speed settings under test
+    int nspeeds;
+    int opponent;                  // left paddle: -1 sweeps, else AI speed
+    long long games;               // per setting
+    unsigned int seed;
+    long long next;                // next unclaimed (setting, game) pair
+    SimResult results[MAX_SIM_SETTINGS];
+    pthread_mutex_t lock;
+} Simulation;
+
+// Function to pick the scripted left paddle's move: sweep the whole
+// field top to bottom and back, ignoring the ball
+int sweep_move(const Game *game) {
+    int span = HEIGHT - game->left_paddle.height;
+    int phase = game->rally * 7 + game->ball.pos.x; // vary it between points
+    int target = phase % (2 * span);
+
+    if (target > span)
+        target = 2 * span - target;
+    return target < game->left_paddle.pos.y ? -1 : target > game->left_paddle.pos.y;
+}
 
-        // Slow down AI if its score is high and the player's score is low
-        if (*right_score > 5 && *left_score < 5) {
-            ai_speed = 1; // Slow down AI
+// Function to mix a game number into a well spread, nonzero seed
+unsigned int game_seed(unsigned int seed, long long n) {
+    unsigned long long z = seed + (unsigned long long)n * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (unsigned int)z | 1;
+}
+
+void simulate_game(Simulation *sim, int speed, long long n, SimResult *result) {
+    Game game;
+    long long tick;
+
+    new_game(&game, SINGLE_PLAYER, speed, game_seed(sim->seed, n));
+    if (sim->opponent > 0)
+        game.left_ai_speed = sim->opponent;
+    serve_ball(&game);
+
+    for (tick = 0; tick < MAX_GAME_TICKS && !game.winner; tick++) {
+        Input input = { 0, 0 };
+
+        if (sim->opponent < 0)
+            input.left_dy = sweep_move(&game);
+        if (update_game(&game, &input))
+            result->rallies[game.last_rally < MAX_RALLY ? game.last_rally : MAX_RALLY]++;
+    }
+
+    result->games++;
+    result->ticks += tick;
+    if (game.winner == 1) {
+        result->left_wins++;
+    } else if (game.winner == 2) {
+        result->right_wins++;
+    } else {
+        result->draws++;
+    }
+}
+
+static void *simulation_worker(void *arg) {
+    Simulation *sim = arg;
+    long long total = sim->games * sim->nspeeds;
+    long long first;
+
+    while ((first = __atomic_fetch_add(&sim->next, SIM_CHUNK, __ATOMIC_RELAXED)) < total) {
+        long long last = first + SIM_CHUNK < total ? first + SIM_CHUNK : total;
+
+        // A chunk may straddle two settings; flush whenever the setting changes
+        while (first < last) {
+            int setting = first / sim->games;
+            long long end = (setting + 1) * sim->games < last ? (setting + 1) * sim->games : last;
+            SimResult local = { 0 };
+            SimResult *shared = &sim->results[setting];
+
+            for (long long i = first; i < end; i++)
+                simulate_game(sim, sim->speeds[setting], i % sim->games, &local);
+
+            pthread_mutex_lock(&sim->lock);
+            shared->games += local.games;
+            shared->left_wins += local.left_wins;
+            shared->right_wins += local.right_wins;
+            shared->draws += local.draws;
+            shared->ticks += local.ticks;
+            for (int r = 0; r <= MAX_RALLY; r++)
+                shared->rallies[r] += local.rallies[r];
+            pthread_mutex_unlock(&sim->lock);
+
+            first = end;
+        }
+    }
+    return NULL;
+}
+
+// Function to find the rally length below which a fraction of points end
+static int rally_percentile(const SimResult *result, long long points, double fraction) {
+    long long seen = 0;
+
+    for (int r = 0; r <= MAX_RALLY; r++) {
+        seen += result->rallies[r];
+        if (seen > points * fraction)
+            return r;
+    }
+    return MAX_RALLY;
+}
+
+static void print_simulation(const Simulation *sim, double seconds) {
+    printf("%-8s %10s %7s %7s %7s %8s %5s %5s %5s %6s\n",
+           "ai_speed", "games", "ai win", "ai loss", "draw", "rally", "p50", "p90", "p99", "max");
+
+    for (int s = 0; s < sim->nspeeds; s++) {
+        const SimResult *result = &sim->results[s];
+        long long points = 0, hits = 0;
+        int longest = 0;
+        char name[16];
+
+        for (int r = 0; r <= MAX_RALLY; r++) {
+            points += result->rallies[r];
+            hits += (long long)r * result->rallies[r];
+            if (result->rallies[r])
+                longest = r;
+        }
+        if (sim->speeds[s]) {
+            snprintf(name, sizeof(name), "%d", sim->speeds[s]);
         } else {
-            ai_speed = 2; // Normal AI speed
+            snprintf(name, sizeof(name), "adaptive");
         }
 
-        if (ball->pos.y < right_paddle->pos.y) {
-            right_paddle->pos.y -= ai_speed;
-        } else if (ball->pos.y > right_paddle->pos.y + right_paddle->height - 1) {
-            right_paddle->pos.y += ai_speed;
+        printf("%-8s %10lld %6.2f%% %6.2f%% %6.2f%% %8.2f %5d %5d %5d %5d%s\n", name, result->games,
+               100.0 * result->right_wins / result->games, 100.0 * result->left_wins / result->games,
+               100.0 * result->draws / result->games, points ? (double)hits / points : 0.0,
+               rally_percentile(result, points, 0.5), rally_percentile(result, points, 0.9),
+               rally_percentile(result, points, 0.99), longest, longest == MAX_RALLY ? "+" : "");
+    }
+
+    long long games = sim->games * sim->nspeeds;
+    printf("\n%lld games in %.3f s (%.0f games/s)\n", games, seconds, games / seconds);
+}
+
+// Function to run a full simulation and print the results
+int run_simulation(Simulation *sim, int threads) {
+    pthread_t workers[256];
+    int started = 0;
+    struct timespec start, end;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > 256)
+        threads = 256;
+
+    pthread_mutex_init(&sim->lock, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, simulation_worker, sim) == 0)
+            started++;
+    }
+    simulation_worker(sim);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_destroy(&sim->lock);
+
+    if (sim->opponent < 0) {
+        printf("Right paddle AI vs sweeping left paddle, %d threads\n\n", started + 1);
+    } else {
+        printf("Right paddle AI vs speed %d AI left paddle, %d threads\n\n", sim->opponent, started + 1);
+    }
+    print_simulation(sim, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return 0;
+}
+
+// Network play
+//
+// Two players, each on their own machine, over UDP. Every tick is simulated
+// as soon as it's due using the local player's real input and a guess for
+// the remote one (whatever they did last), so local keys show up with no
+// added delay. When the remote player's input for a tick arrives and turns
+// out different from the guess, the game is rewound to the snapshot taken
+// before that tick and replayed with the real inputs.
+//
+// Every packet carries all of our inputs the peer hasn't acknowledged yet,
+// so a lost packet is simply covered by the next one.
+
+#define NET_MAGIC 0x474E5047u   // "GPNG"
+#define ROLLBACK_WINDOW 64      // ticks we may run ahead of the peer's input
+#define NET_HISTORY 256         // ticks of inputs and snapshots kept
+#define NET_MAX_INPUTS 64       // inputs per packet
+#define NET_MAX_DELAYED 1024    // packets held back by --lag
+#define NET_TIMEOUT_NS 5000000000LL
+
+enum {
+    NET_HELLO,    // joiner -> host, until welcomed
+    NET_WELCOME,  // host -> joiner: seed and tick rate
+    NET_INPUT,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint8_t type;
+    uint8_t count;           // inputs carried
+    uint16_t tick_rate;      // NET_WELCOME
+    uint32_t seed;           // NET_WELCOME
+    uint32_t first;          // tick of inputs[0]
+    uint32_t ack;            // sender holds our inputs for every tick before this
+    int8_t inputs[NET_MAX_INPUTS];
+} Packet;
+
+typedef struct {
+    int fd;
+    int side;                        // 1: left paddle (host), 2: right paddle
+    unsigned int tick;               // next tick to simulate
+    unsigned int remote_have;        // remote inputs known for every tick before this
+    unsigned int peer_ack;           // peer holds our inputs for every tick before this
+    unsigned int rewind_to;          // earliest mispredicted tick, or UINT_MAX
+    unsigned int win_tick;           // tick the game was won on, or UINT_MAX
+    int8_t local[NET_HISTORY];
+    int8_t remote[NET_HISTORY];      // real, or predicted past remote_have
+    Game snapshots[NET_HISTORY];     // state before each tick
+    long long last_heard;
+
+    // Simulated bad network, applied to everything we send
+    int lag_ms;
+    int loss_percent;
+    unsigned int loss_rng;
+    struct {
+        long long due;
+        Packet packet;
+    } delayed[NET_MAX_DELAYED];
+    int delayed_head;
+    int delayed_count;
+
+    long long rollbacks;
+    long long replayed_ticks;
+} NetPlay;
+
+static NetPlay *net_stats; // reported by --stats
+
+static void net_send_now(NetPlay *net, const Packet *packet) {
+    // Failures are ignored: the next packet carries the same inputs again
+    (void)!send(net->fd, packet, sizeof(*packet), 0);
+}
+
+// Function to send a packet through the simulated network
+void net_send(NetPlay *net, const Packet *packet) {
+    if (net->loss_percent > 0) {
+        net->loss_rng ^= net->loss_rng << 13;
+        net->loss_rng ^= net->loss_rng >> 17;
+        net->loss_rng ^= net->loss_rng << 5;
+        if ((int)(net->loss_rng % 100) < net->loss_percent)
+            return;
+    }
+    if (net->lag_ms <= 0) {
+        net_send_now(net, packet);
+        return;
+    }
+    if (net->delayed_count == NET_MAX_DELAYED)
+        return; // queue full: counts as lost
+
+    int slot = (net->delayed_head + net->delayed_count++) % NET_MAX_DELAYED;
+    net->delayed[slot].due = now_ns() + net->lag_ms * 1000000LL;
+    net->delayed[slot].packet = *packet;
+}
+
+// Function to release the delayed packets whose time has come. Returns when
+// the next one is due (LLONG_MAX if none).
+long long net_flush(NetPlay *net) {
+    long long now = now_ns();
+
+    while (net->delayed_count > 0) {
+        if (net->delayed[net->delayed_head].due > now)
+            return net->delayed[net->delayed_head].due;
+        net_send_now(net, &net->delayed[net->delayed_head].packet);
+        net->delayed_head = (net->delayed_head + 1) % NET_MAX_DELAYED;
+        net->delayed_count--;
+    }
+    return LLONG_MAX;
+}
+
+// Function to send every input of ours the peer hasn't acknowledged
+void net_send_inputs(NetPlay *net) {
+    Packet packet = {
+        .magic = NET_MAGIC,
+        .type = NET_INPUT,
+        .first = net->peer_ack,
+        .ack = net->remote_have,
+    };
+    unsigned int pending = net->tick - net->peer_ack;
+
+    packet.count = pending < NET_MAX_INPUTS ? pending : NET_MAX_INPUTS;
+    for (int i = 0; i < packet.count; i++)
+        packet.inputs[i] = net->local[(packet.first + i) % NET_HISTORY];
+    net_send(net, &packet);
+}
+
+// Function to build the inputs both paddles used on a tick
+static Input net_input(const NetPlay *net, unsigned int tick) {
+    int local = net->local[tick % NET_HISTORY];
+    int remote = net->remote[tick % NET_HISTORY];
+    Input input = { 0, 0 };
+
+    input.left_dy = net->side == 1 ? local : remote;
+    input.right_dy = net->side == 1 ? remote : local;
+    return input;
+}
+
+// Function to guess the remote input for a tick we have no word on yet
+static void net_predict(NetPlay *net, unsigned int tick) {
+    if (tick >= net->remote_have)
+        net->remote[tick % NET_HISTORY] = net->remote_have ? net->remote[(net->remote_have - 1) % NET_HISTORY] : 0;
+}
+
+// Function to take in whatever the peer sent, rewinding and replaying the
+// game if it shows we guessed wrong
+void net_receive(NetPlay *net, Game *game) {
+    Packet packet;
+
+    while (recv(net->fd, &packet, sizeof(packet), MSG_DONTWAIT) == sizeof(packet)) {
+        if (packet.magic != NET_MAGIC || packet.type != NET_INPUT || packet.count > NET_MAX_INPUTS)
+            continue;
+        net->last_heard = now_ns();
+        if (packet.ack > net->peer_ack && packet.ack <= net->tick)
+            net->peer_ack = packet.ack;
+
+        for (unsigned int i = 0; i < packet.count; i++) {
+            unsigned int tick = packet.first + i;
+            int8_t *slot = &net->remote[tick % NET_HISTORY];
+
+            if (tick != net->remote_have)
+                continue; // already have it, or past a gap the next packet fills
+            if (tick < net->tick && *slot != packet.inputs[i] && tick < net->rewind_to)
+                net->rewind_to = tick;
+            *slot = packet.inputs[i];
+            net->remote_have++;
         }
+    }
 
-        // Ensure AI paddle stays within the bounds
-        if (right_paddle->pos.y < 0) {
-            right_paddle->pos.y = 0;
-        } else if (right_paddle->pos.y > HEIGHT - right_paddle->height) {
-            right_paddle->pos.y = HEIGHT - right_paddle->height;
+    if (net->rewind_to < net->tick) {
+        // A won game stays as it was on the winning tick, however far we
+        // ran ahead of it on predictions
+        *game = net->snapshots[net->rewind_to % NET_HISTORY];
+        if (net->rewind_to <= net->win_tick)
+            net->win_tick = UINT_MAX;
+        for (unsigned int tick = net->rewind_to; tick < net->tick; tick++) {
+            Input input;
+
+            net_predict(net, tick);
+            input = net_input(net, tick);
+            net->snapshots[tick % NET_HISTORY] = *game;
+            if (!game->winner && (update_game(game, &input), game->winner))
+                net->win_tick = tick;
         }
+        net->rollbacks++;
+        net->replayed_ticks += net->tick - net->rewind_to;
+    }
+    net->rewind_to = UINT_MAX;
+}
+
+// Function to check whether the next tick may be simulated: not too far
+// past the peer's input, and not past a win that isn't confirmed yet
+int net_can_advance(const NetPlay *net, const Game *game) {
+    return !game->winner &&
+           net->tick < net->remote_have + ROLLBACK_WINDOW && // the peer may be ahead of us
+           net->tick < net->peer_ack + NET_HISTORY - NET_MAX_INPUTS;
+}
+
+// Function to check whether the game so far used only real inputs. Once
+// it's won, only the ticks up to the win count: the peer stops there and
+// never sends inputs for any we predicted past it.
+int net_confirmed(const NetPlay *net) {
+    return net->remote_have >= (net->win_tick != UINT_MAX ? net->win_tick + 1 : net->tick);
+}
+
+// Function to simulate the next tick with our input and the best guess
+// for the peer's
+void net_advance(NetPlay *net, Game *game, const Input *input) {
+    int dy = input->left_dy + input->right_dy; // either key set moves our paddle
+    unsigned int tick = net->tick;
+
+    net->local[tick % NET_HISTORY] = dy < -127 ? -127 : dy > 127 ? 127 : dy;
+    net_predict(net, tick);
+    net->snapshots[tick % NET_HISTORY] = *game;
+
+    Input both = net_input(net, tick);
+    update_game(game, &both);
+    if (game->winner)
+        net->win_tick = tick;
+    net->tick++;
+}
+
+// Function to make sure the peer ends up with our last inputs before we go
+void net_finish(NetPlay *net) {
+    Packet packet = {
+        .magic = NET_MAGIC,
+        .type = NET_INPUT,
+        .first = net->peer_ack,
+        .ack = net->remote_have,
+    };
+    unsigned int pending = net->tick - net->peer_ack;
+
+    net_flush(net);
+    packet.count = pending < NET_MAX_INPUTS ? pending : NET_MAX_INPUTS;
+    for (int i = 0; i < packet.count; i++)
+        packet.inputs[i] = net->local[(packet.first + i) % NET_HISTORY];
+    for (int i = 0; i < 10; i++)
+        net_send_now(net, &packet);
+}
+
+// Function to open a UDP socket for addr, bound (host) or connected (join)
+static int net_socket(const char *host, const char *port, int bind_it) {
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM, .ai_flags = bind_it ? AI_PASSIVE : 0 };
+    struct addrinfo *res;
+    int fd;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && (bind_it ? bind(fd, res->ai_addr, res->ai_addrlen) : connect(fd, res->ai_addr, res->ai_addrlen)) < 0) {
+        close(fd);
+        fd = -1;
     }
+    freeaddrinfo(res);
+    return fd;
 }
 
-int main() {
-    Ball ball = {{WIDTH / 2, HEIGHT / 2}, {1, 1}};
-    Paddle left_paddle = {{1, HEIGHT / 2 - PADDLE_HEIGHT / 2}, PADDLE_HEIGHT};
-    Paddle right_paddle = {{WIDTH - 2, HEIGHT / 2 - PADDLE_HEIGHT / 2}, PADDLE_HEIGHT};
+// Function to wait for a player to join on port. Picks the seed and tick
+// rate for both sides.
+int net_host(NetPlay *net, const char *port, unsigned int seed, int tick_rate) {
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    Packet packet;
+
+    net->fd = net_socket(NULL, port, 1);
+    if (net->fd < 0)
+        return -1;
+
+    printf("Waiting for player 2 on UDP port %s...\n", port);
+    fflush(stdout);
+    do {
+        if (recvfrom(net->fd, &packet, sizeof(packet), 0, (struct sockaddr *)&peer, &peer_len) < 0)
+            return -1;
+    } while (packet.magic != NET_MAGIC || packet.type != NET_HELLO);
+
+    if (connect(net->fd, (struct sockaddr *)&peer, peer_len) < 0)
+        return -1;
+
+    Packet welcome = { .magic = NET_MAGIC, .type = NET_WELCOME, .seed = seed, .tick_rate = tick_rate };
+    for (int i = 0; i < 5; i++) // the joiner starts on the first of these
+        net_send_now(net, &welcome);
+    net->side = 1;
+    return 0;
+}
+
+// Function to join a game at host:port. Returns the seed and tick rate the
+// host picked.
+int net_join(NetPlay *net, const char *address, unsigned int *seed, int *tick_rate) {
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    Packet hello = { .magic = NET_MAGIC, .type = NET_HELLO };
+    Packet packet;
+
+    if (!colon || colon - address >= (int)sizeof(host))
+        return -1;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    net->fd = net_socket(host, colon + 1, 0);
+    if (net->fd < 0)
+        return -1;
+
+    printf("Joining %s...\n", address);
+    fflush(stdout);
+    for (int tries = 0; tries < 100; tries++) {
+        struct pollfd pfd = { .fd = net->fd, .events = POLLIN };
+
+        net_send_now(net, &hello);
+        if (poll(&pfd, 1, 200) > 0 &&
+            recv(net->fd, &packet, sizeof(packet), 0) == sizeof(packet) &&
+            packet.magic == NET_MAGIC && packet.type == NET_WELCOME) {
+            *seed = packet.seed;
+            *tick_rate = packet.tick_rate;
+            net->side = 2;
+            return 0;
+        }
+    }
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+// Frame timing statistics, kept with --stats and reported on exit. Left
+// zero-initialized so the sample arrays take no room in the binary.
+typedef struct {
+    long long samples[MAX_STAT_SAMPLES];
+    int count;
+} Stat;
+
+static Stat tick_jitter;
+static Stat render_time;
+static Stat input_latency;
+static int stats_enabled;
+static long long frame_bytes_total, frames_drawn;
+
+static void stat_add(Stat *stat, long long ns) {
+    if (stats_enabled && stat->count < MAX_STAT_SAMPLES)
+        stat->samples[stat->count++] = ns;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_stat(const char *name, Stat *stat) {
+    if (!stat->count) {
+        printf("%-17s no samples\n", name);
+        return;
+    }
+
+    qsort(stat->samples, stat->count, sizeof(stat->samples[0]), compare_ll);
+    long long *v = stat->samples;
+    int n = stat->count;
+    printf("%-17s %7d  p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n", name, n,
+           v[n / 2] / 1e6, v[n * 9 / 10] / 1e6, v[n * 99 / 100] / 1e6, v[n - 1] / 1e6);
+}
+
+static void report_stats(void) {
+    printf("%-17s %7s\n", "", "samples");
+    print_stat("tick jitter", &tick_jitter);
+    print_stat("render time", &render_time);
+    print_stat("input to display", &input_latency);
+    if (frames_drawn)
+        printf("%-17s %7lld  %.1f bytes/frame\n", "output", frames_drawn,
+               (double)frame_bytes_total / frames_drawn);
+    if (net_stats)
+        printf("%-17s %7lld  %lld ticks replayed\n", "rollbacks", net_stats->rollbacks,
+               net_stats->replayed_ticks);
+}
+
+// Function to sleep until an absolute CLOCK_MONOTONIC deadline
+static void sleep_until(long long deadline) {
+    struct timespec ts = { deadline / 1000000000LL, deadline % 1000000000LL };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--tick-rate HZ] [--fps HZ] [--stats]\n"
+                    "              [--host PORT | --join HOST:PORT] [--lag MS] [--loss PERCENT]\n", prog);
+    fprintf(stderr, "       %s --simulate GAMES [--speeds LIST] [--opponent sweep|SPEED]\n"
+                    "              [--threads N] [--seed N]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    Game game;
     GameMode mode;
-    int left_score = 0;
-    int right_score = 0;
+    int tick_rate = TICK_RATE;
+    int render_rate = TICK_RATE;
+    static Simulation sim; // zero-initialized, so its results stay in .bss
+    int threads = 0;
+    static NetPlay netplay; // zero-initialized, so its buffers stay in .bss
+    NetPlay *net = NULL;
+    const char *host_port = NULL, *join_address = NULL;
+
+    for (sim.nspeeds = 0; sim.nspeeds < 4; sim.nspeeds++)
+        sim.speeds[sim.nspeeds] = sim.nspeeds; // adaptive, then 1-3
+    sim.opponent = -1;
+    sim.seed = 1;
+    netplay.fd = -1;
+    netplay.rewind_to = UINT_MAX;
+    netplay.win_tick = UINT_MAX;
+    netplay.loss_rng = 0x2545F491;
 
-    draw_title_screen(&mode);
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--simulate") && i + 1 < argc) {
+            sim.games = atoll(argv[++i]);
+        } else if (!strcmp(argv[i], "--speeds") && i + 1 < argc) {
+            char *list = argv[++i];
+            sim.nspeeds = 0;
+            for (char *tok = strtok(list, ","); tok && sim.nspeeds < MAX_SIM_SETTINGS; tok = strtok(NULL, ","))
+                sim.speeds[sim.nspeeds++] = strcmp(tok, "adaptive") ? atoi(tok) : 0;
+        } else if (!strcmp(argv[i], "--opponent") && i + 1 < argc) {
+            i++;
+            sim.opponent = strcmp(argv[i], "sweep") ? atoi(argv[i]) : -1;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            sim.seed = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "--tick-rate") && i + 1 < argc) {
+            tick_rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            render_rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--stats")) {
+            stats_enabled = 1;
+        } else if (!strcmp(argv[i], "--host") && i + 1 < argc) {
+            host_port = argv[++i];
+        } else if (!strcmp(argv[i], "--join") && i + 1 < argc) {
+            join_address = argv[++i];
+        } else if (!strcmp(argv[i], "--lag") && i + 1 < argc) {
+            netplay.lag_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--loss") && i + 1 < argc) {
+            netplay.loss_percent = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (tick_rate <= 0 || render_rate <= 0 || sim.nspeeds == 0 || sim.opponent == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (sim.games > 0)
+        return run_simulation(&sim, threads);
+
+    // Registered first so it runs after the terminal has been restored
+    if (stats_enabled)
+        atexit(report_stats);
+
+    unsigned int seed = (unsigned int)now_ns();
+
+    if (host_port || join_address) {
+        net = &netplay;
+        if (host_port ? net_host(net, host_port, seed, tick_rate) < 0
+                      : net_join(net, join_address, &seed, &tick_rate) < 0) {
+            fprintf(stderr, "Network play: %s\n", strerror(errno));
+            return 1;
+        }
+        net->last_heard = now_ns();
+        net_stats = net;
+        mode = MULTIPLAYER;
+    }
+
+    enter_raw_mode();
+    if (!net)
+        draw_title_screen(&mode);
+    invalidate_screen();
+    start_input();
+
+    new_game(&game, mode, 0, seed);
+
+    // The simulation advances on a fixed grid of absolute deadlines, so time
+    // spent rendering or reading input never stretches a tick. Rendering
+    // runs on its own grid at the requested frame rate.
+    const long long tick_ns = 1000000000LL / tick_rate;
+    const long long render_ns = 1000000000LL / render_rate;
+    long long next_tick = now_ns();
+    long long next_render = next_tick;
+    long long latency_from = 0; // oldest key applied but not yet on screen
 
     while (1) {
-        update_game(&ball, &left_paddle, &right_paddle, mode, &left_score, &right_score);
-        draw_frame(&ball, &left_paddle, &right_paddle, left_score, right_score);
-        usleep(50000); // Sleep for 50 ms
+        long long now = now_ns();
+        int ticks = 0;
+
+        while (now >= next_tick && ticks < MAX_CATCHUP_TICKS) {
+            Input input;
+            long long since;
+
+            stat_add(&tick_jitter, now - next_tick);
+            if (net) {
+                net_receive(net, &game);
+                if (now - net->last_heard > NET_TIMEOUT_NS) {
+                    clear_screen();
+                    printf("Connection lost\n");
+                    exit(1);
+                }
+            }
+
+            // Online, hold the tick while we wait on the peer
+            if (!net || net_can_advance(net, &game)) {
+                if (take_input(&input, &since)) {
+                    if (net)
+                        net_finish(net);
+                    exit(0);
+                }
+                if (since && !latency_from)
+                    latency_from = since;
+                if (net) {
+                    net_advance(net, &game, &input);
+                } else {
+                    update_game(&game, &input);
+                }
+            }
+            if (net)
+                net_send_inputs(net);
+
+            if (game.winner && (!net || net_confirmed(net))) {
+                if (net)
+                    net_finish(net);
+                clear_screen();
+                printf("Player %d Wins!\n", game.winner);
+                exit(0);
+            }
+            next_tick += tick_ns;
+            ticks++;
+            now = now_ns();
+        }
+        if (now >= next_tick) {
+            // Too far behind to catch up: drop the backlog instead of spiralling
+            next_tick = now + tick_ns;
+        }
+
+        if (now >= next_render) {
+            size_t bytes = draw_frame(&game);
+            long long drawn = now_ns();
+
+            stat_add(&render_time, drawn - now);
+            if (latency_from) {
+                stat_add(&input_latency, drawn - latency_from);
+                latency_from = 0;
+            }
+            frame_bytes_total += bytes;
+            frames_drawn++;
+
+            next_render += render_ns;
+            if (next_render <= drawn)
+                next_render = drawn + render_ns;
+        }
+
+        long long wake = next_tick < next_render ? next_tick : next_render;
+        if (net) {
+            long long due = net_flush(net);
+            if (due < wake)
+                wake = due;
+        }
+        sleep_until(wake);
     }
 
     return 0;